@@ -0,0 +1,138 @@
+﻿#pragma once
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "MidiModule.h"
+
+namespace rlib::midi {
+
+	// リバーブ (FDN:Feedback Delay Network)
+	// 8本の遅延線をハウスホルダー行列で帰還させる。モジュール毎に1つ持ち、送りバスをブロック単位でまとめて処理する
+	template <typename T = double> class Reverb {
+		static constexpr size_t lineCount = 8;
+		struct Line {
+			std::vector<T>	buffer;
+			size_t			position = 0;
+			T				feedback = 0;	// 帰還量(残響時間から算出)
+			T				lowpass = 0;	// 高域減衰用 1次ローパスの状態
+		};
+		std::array<Line, lineCount>	m_lines;
+		const T			m_damping;			// 高域減衰 0.0～1.0
+		const T			m_wet;				// 出力音量
+		const size_t	m_tail;				// 残響の長さ(サンプル数)
+		size_t			m_remain = 0;		// 残響の残りサンプル数
+	public:
+		// time:残響時間(60dB減衰するまでの秒数)
+		Reverb(uint32_t sampleRate, T time = static_cast<T>(2.0), T damping = static_cast<T>(0.3), T wet = static_cast<T>(0.5))
+			: m_damping(damping)
+			, m_wet(wet)
+			, m_tail(static_cast<size_t>(time * sampleRate))
+		{
+			static constexpr std::array<size_t, lineCount> lengths = { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 };	// 44100Hz の時の遅延サンプル数
+			for (size_t n = 0; n < lineCount; n++) {
+				auto& line = m_lines[n];
+				const size_t length = (std::max<size_t>)(1, lengths[n] * sampleRate / 44100);
+				line.buffer.assign(length, 0);
+				line.feedback = std::pow(static_cast<T>(10.0), static_cast<T>(-3.0) * length / (time * sampleRate));	// 残響時間で -60dB
+			}
+		}
+
+		// 残響が残っているか
+		bool isActive()const { return m_remain > 0; }
+
+		// input(送りバス) を処理して output へ加算する。input が nullptr なら入力無しとして残響のみ出力
+		void process(const StereoSample<T>* input, StereoSample<T>* output, size_t size) {
+			if (input) {
+				m_remain = m_tail + size;
+			} else if (m_remain == 0) {
+				return;
+			}
+			constexpr T inputGain = static_cast<T>(1.0) / lineCount;
+			constexpr T outputGain = static_cast<T>(2.0) / lineCount;
+			constexpr T householder = static_cast<T>(2.0) / lineCount;		// ハウスホルダー行列 (I - 2/N * 11^T)
+			for (size_t i = 0; i < size; i++) {
+				const T in = input ? (input[i].l + input[i].r) * inputGain : 0;
+				std::array<T, lineCount> x;
+				T sum = 0;
+				for (size_t n = 0; n < lineCount; n++) {
+					auto& line = m_lines[n];
+					const T y = line.buffer[line.position];
+					line.lowpass = y + (line.lowpass - y) * m_damping;
+					x[n] = line.lowpass;
+					sum += x[n];
+				}
+				const T h = sum * householder;
+				T l = 0, r = 0;
+				for (size_t n = 0; n < lineCount; n++) {
+					auto& line = m_lines[n];
+					if (n % 2 == 0) l += x[n];
+					else r += x[n];
+					line.buffer[line.position] = in + (x[n] - h) * line.feedback;
+					if (++line.position >= line.buffer.size()) line.position = 0;
+				}
+				output[i].l += l * (outputGain * m_wet);
+				output[i].r += r * (outputGain * m_wet);
+			}
+			m_remain = m_remain > size ? m_remain - size : 0;
+		}
+	};
+
+	// コーラス (LFO で遅延時間を揺らした遅延音。L,R で LFO の位相を90°ずらす)
+	template <typename T = double> class Chorus {
+		std::vector<StereoSample<T>>	m_buffer;
+		size_t			m_position = 0;
+		const T			m_delay;				// 遅延時間の中心(サンプル数)
+		const T			m_depth;				// 遅延時間の揺れ幅(サンプル数)
+		const T			m_wet;					// 出力音量
+		std::pair<T, T>	m_lfo{ 1, 0 };			// LFO (cos,sin)
+		std::pair<T, T>	m_lfoStep;				// LFO 1サンプルあたりの回転
+		size_t			m_remain = 0;			// 遅延音の残りサンプル数
+	public:
+		// delay,depth:秒 rate:LFO周波数(Hz)
+		Chorus(uint32_t sampleRate, T delay = static_cast<T>(0.012), T depth = static_cast<T>(0.003), T rate = static_cast<T>(0.4), T wet = static_cast<T>(0.5))
+			: m_delay(delay * sampleRate)
+			, m_depth(depth * sampleRate)
+			, m_wet(wet)
+		{
+			m_buffer.assign(static_cast<size_t>(m_delay + m_depth) + 2, {});
+			constexpr T pi2 = static_cast<T>(3.14159265358979323846 * 2.0);
+			const T w = pi2 * rate / sampleRate;
+			m_lfoStep = { std::cos(w), std::sin(w) };
+		}
+
+		// 遅延音が残っているか
+		bool isActive()const { return m_remain > 0; }
+
+		// input(送りバス) を処理して output へ加算する。input が nullptr なら入力無しとして遅延音のみ出力
+		void process(const StereoSample<T>* input, StereoSample<T>* output, size_t size) {
+			if (input) {
+				m_remain = m_buffer.size() + size;
+			} else if (m_remain == 0) {
+				return;
+			}
+			const size_t length = m_buffer.size();
+			const auto read = [&](T delay, T StereoSample<T>::* channel) {
+				const T pos = static_cast<T>(m_position + length) - delay;
+				const size_t i = static_cast<size_t>(pos);
+				const T decimal = pos - i;
+				const T a = m_buffer[i % length].*channel;
+				const T b = m_buffer[(i + 1) % length].*channel;
+				return a + (b - a) * decimal;
+			};
+			for (size_t i = 0; i < size; i++) {
+				m_buffer[m_position] = input ? input[i] : StereoSample<T>{};
+				output[i].l += read(m_delay + m_depth * m_lfo.second, &StereoSample<T>::l) * m_wet;
+				output[i].r += read(m_delay + m_depth * m_lfo.first, &StereoSample<T>::r) * m_wet;
+				if (++m_position >= length) m_position = 0;
+				m_lfo = { m_lfo.first * m_lfoStep.first - m_lfo.second * m_lfoStep.second, m_lfo.second * m_lfoStep.first + m_lfo.first * m_lfoStep.second };
+			}
+			const T norm = 1 / std::sqrt(m_lfo.first * m_lfo.first + m_lfo.second * m_lfo.second);		// 誤差の蓄積を補正
+			m_lfo.first *= norm;
+			m_lfo.second *= norm;
+			m_remain = m_remain > size ? m_remain - size : 0;
+		}
+	};
+
+}
@@ -10,11 +10,29 @@
 #include "./MidiEvent.h"
 #include "./MidiModule.h"
 #include "./FmRenderer.h"
+#include "./Resampler.h"
 
 namespace rlib::fm {
 
 
 	template <typename T = double> class MidiModuleT : public midi::MidiModuleBase<T> {
+	public:
+		// レンダリングエンジン
+		enum class Engine {
+			note,		// ノート毎に ym2203 を1つ使う(チャンネル0のみ使用)
+			pool,		// MIDIチャンネル毎に FM部のみのチップを持ち、1チップに3ボイスまで割り当てる (RendererT::ChipPool)
+						// チップのサンプリングレートのままミックスし、モジュールで1つの Resampler で出力サンプリングレートへ変換する
+			voice,		// MIDIチャンネル毎に全ボイスの FM部を SoA 配列で持ち、揃えて一括レンダリングする (RendererT::VoiceEngine)
+						// 出力は pool と同様にチップのサンプリングレートのままミックスして変換する
+		};
+		// 名前からレンダリングエンジンを取得 ("note" | "pool" | "voice")
+		static Engine toEngine(std::string_view name) {
+			if (name == "note") return Engine::note;
+			if (name == "pool") return Engine::pool;
+			if (name == "voice") return Engine::voice;
+			throw std::runtime_error("unknown fm engine.");
+		}
+	private:
 		using Bit14 = midi::utility::Bit14;
 
 		struct Preset {
@@ -288,6 +306,9 @@ namespace rlib::fm {
 		};
 
 		RendererT<T>	m_renderer;
+		const Engine	m_engine;
+		midi::Resampler<T>	m_resampler;		// Engine::pool, Engine::voice の場合のサンプリングレート変換 (チップ → 出力)
+		std::vector<midi::StereoSample<T>>	m_bus;	// Engine::pool, Engine::voice の場合のチップのサンプリングレートでのミックス結果
 
 		struct Channel{
 			const uint8_t	m_channel;
@@ -328,37 +349,78 @@ namespace rlib::fm {
 			std::optional<Bit14>	m_rpn;
 			Bit14					m_dataEntry;
 
-			std::map<uint8_t, std::shared_ptr<typename RendererT<T>::Note>>	m_notes;
+			midi::NoteTable<typename RendererT<T>::Note>	m_notes;		// 発音中のノート
+			std::unique_ptr<typename RendererT<T>::ChipPool>	m_pool;		// Engine::pool の場合のチッププール(最初のノートオンで生成)
+			std::unique_ptr<typename RendererT<T>::VoiceEngine>	m_voices;	// Engine::voice の場合のボイス(最初のノートオンで生成)
 
 			Channel(uint8_t channel)
 				:m_channel(channel)
 			{
 			}
 
-			struct Less {
-				typedef void is_transparent;
-				bool operator()(const Channel& a, const Channel& b)				const { return a.m_channel < b.m_channel; }
-				bool operator()(const decltype(m_channel) a, const Channel& b)	const { return a < b.m_channel; }
-				bool operator()(const Channel& a, const decltype(m_channel) b)	const { return a.m_channel < b; }
-			};
+			// 発音中か
+			bool isActive()const {
+				return !m_notes.empty() || (m_pool && !m_pool->empty()) || (m_voices && !m_voices->empty());
+			}
 
 		};
-		std::set<Channel, typename Channel::Less>	m_channels;
+		std::array<Channel, 16>	m_channels = midi::makeChannels<Channel>();
 		uint16_t	m_masterVolume = 16383;	// マスターボリューム 0-～16383 (14bit)
 
-		Channel& ensureChannel(uint8_t channel) {
-			if (auto i = m_channels.find(channel); i != m_channels.end() ){
-				return const_cast<Channel&>(*i);
+		Channel& getChannel(uint8_t channel) {
+			return m_channels[channel & 0xf];
+		}
+
+		// volume,expression,pan,masterVolume を掛け合わせたl,r振幅値 (channel.m_gain算出)
+		const std::pair<T, T>& getGain(Channel& channel)const {
+			if (!channel.m_gain) {
+				const T n = midi::volumeGainTable<T>[channel.m_volume] * midi::volumeGainTable<T>[channel.m_expression] * (m_masterVolume * (static_cast<T>(1.0) / 16383)); // volume,expression,masterVolume
+				const auto& pan = midi::panGainTable<T>[channel.m_pan];
+				channel.m_gain = { n * pan.first, n * pan.second };
 			}
-			auto i = m_channels.emplace(channel);
-			return const_cast<Channel&>(*i.first);
+			return *channel.m_gain;
+		}
+
+		// Engine::pool, Engine::voice のレンダリング
+		// チャンネル毎のプール(ボイス)の出力をチップのサンプリングレートのままミックスし、まとめてサンプリングレート変換する
+		std::vector<typename midi::StereoSample<T>> readSamplesPool(size_t size) {
+#ifdef DISABLE_THREADS
+			constexpr auto asyncLaunch = std::launch::deferred;
+#else
+			constexpr auto asyncLaunch = std::launch::async;
+#endif
+			if (std::none_of(m_channels.begin(), m_channels.end(), [](const Channel& channel) { return channel.isActive(); })) {
+				m_resampler.reset();		// 次の発音に前回の残りが混ざらないように
+				return {};
+			}
+			const size_t inputSize = m_resampler.getInputSize(size);
+			std::vector<std::pair<Channel*, std::future<std::vector<T>>>> futureChannels;
+			for (auto& channel : m_channels) {
+				if (!channel.isActive()) continue;		// 発音中のノートが無いチャンネルは対象外
+				futureChannels.emplace_back(&channel, std::async(asyncLaunch, [&channel, inputSize] {
+					return channel.m_pool ? channel.m_pool->render(inputSize) : channel.m_voices->render(inputSize);
+				}));
+			}
+
+			m_bus.assign(inputSize, {});
+			for (auto& [channel, f] : futureChannels) {
+				const auto samples = f.get();
+				const auto& gain = getGain(*channel);
+				for (size_t i = 0; i < samples.size(); i++) {
+					m_bus[i].l += samples[i] * gain.first;
+					m_bus[i].r += samples[i] * gain.second;
+				}
+			}
+			std::vector<midi::StereoSample<T>> result(size);
+			m_resampler.process(m_bus.data(), result.data(), size);
+			return result;
 		}
 
 		void eventNoteOn(const midi::Event& event) {
 			const midi::EventNoteOn &ev = static_cast<decltype(ev)>(event);
 			if (ev.velocity == 0) return eventNoteOff(event);	// noteoff?
 
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			const auto itBank = m_presets.find(channel.m_bank);
 			if (itBank == m_presets.end()) return;
 			const auto it = itBank->second.find(channel.m_programNo);
@@ -370,27 +432,37 @@ namespace rlib::fm {
 			key.velocity = ev.velocity;
 			key.fineTune = channel.m_fineTune;
 
+			if (m_engine == Engine::pool) {
+				if (!channel.m_pool) channel.m_pool = m_renderer.createChipPool();
+				channel.m_pool->noteOn(ev.note, key, program.reg, channel.m_pitch.get().result);
+				return;
+			}
+			if (m_engine == Engine::voice) {
+				if (!channel.m_voices) channel.m_voices = m_renderer.createVoiceEngine();
+				channel.m_voices->noteOn(ev.note, key, program.reg, channel.m_pitch.get().result);
+				return;
+			}
 			const auto spNote = m_renderer.createNote(key, program.reg, channel.m_pitch.get().result);
-			channel.m_notes[ev.note] = spNote;
+			channel.m_notes.replace(ev.note, spNote);
 
 		}
 
 		void eventNoteOff(const midi::Event& event) {
 			const midi::EventNote& ev = static_cast<decltype(ev)>(event);			// NoteOn から来ることもあるので midi::EventNote に
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
+			if (channel.m_pool) channel.m_pool->noteOff(ev.note);
+			if (channel.m_voices) channel.m_voices->noteOff(ev.note);
 
-			if (auto i = channel.m_notes.find(ev.note); i != channel.m_notes.end()) {
-				auto sp = i->second;
-				if (!sp) throw std::runtime_error("eventNoteOff not note.");			// failsafe
-				sp->setKeyoff();
-			}
+			channel.m_notes.forKey(ev.note, [](auto& note) {
+				note.setKeyoff();
+			});
 
 		}
 
 		void eventControlChange(const midi::Event& event) {
 			using namespace midi;
 			const EventControlChange& ev = static_cast<decltype(ev)>(event);
-			const auto channel = [&]()->Channel& {return ensureChannel(ev.channel); };
+			const auto channel = [&]()->Channel& {return getChannel(ev.channel); };
 
 			const auto procDataEntry = [&](auto& ch) {
 				if (ch.m_rpn) {
@@ -486,7 +558,7 @@ namespace rlib::fm {
 		void eventProgramChange(const midi::Event& event) {
 			using namespace midi;
 			const EventProgramChange& ev = static_cast<decltype(ev)>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			channel.m_programNo = ev.programNo;
 			channel.m_bank = static_cast<int16_t>(channel.m_backselect.msb) * 0x80 + channel.m_backselect.lsb;
 		}
@@ -494,16 +566,16 @@ namespace rlib::fm {
 		void eventPitchBend(const midi::Event& event) {
 			using namespace midi;
 			const auto& ev = static_cast<const EventPitchBend&>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			const auto& before = channel.m_pitch.get();
 			channel.m_pitch.set(ev.pitchBend, before.pitchBendRange);
 
 			// 発音中のNote に設定
 			const auto pitch = channel.m_pitch.get().result;
-			for (auto note : channel.m_notes) {
-				if (note.second) {		// failsafe
-					note.second->setPitchBend(pitch);
-				}
+			if (channel.m_pool) channel.m_pool->setPitchBend(pitch);
+			if (channel.m_voices) channel.m_voices->setPitchBend(pitch);
+			for (auto& voice : channel.m_notes) {
+				voice.note->setPitchBend(pitch);
 			}
 		}
 
@@ -527,7 +599,7 @@ namespace rlib::fm {
 				u.lsb = ev.data[5];
 				u.msb = ev.data[6];
 				m_masterVolume = u.value;
-				for (auto& ch : m_channels) const_cast<Channel&>(ch).m_gain = std::nullopt;	// 全チャンネル要再計算
+				for (auto& ch : m_channels) ch.m_gain = std::nullopt;	// 全チャンネル要再計算
 				return;
 			}
 
@@ -606,6 +678,7 @@ namespace rlib::fm {
 
 		// レンダリング(波形データ出力（結果配列がsize未満なら完了=無音）
 		std::vector<typename midi::StereoSample<T>> readSamples(size_t size)override {
+			if (m_engine == Engine::pool || m_engine == Engine::voice) return readSamplesPool(size);
 #ifdef DISABLE_THREADS
 			constexpr auto asyncLaunch = std::launch::deferred;
 #else
@@ -613,15 +686,12 @@ namespace rlib::fm {
 #endif
 			std::vector<std::future<std::vector<midi::StereoSample<T>>>> futureChannels;
 			for (auto& channel : m_channels) {
-				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel = const_cast<Channel&>(channel), size, asyncLaunch] {
+				if (!channel.isActive()) continue;		// 発音中のノートが無いチャンネルは対象外
+				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel, size, asyncLaunch] {
 
 					std::vector<T> resultMono;
-					for (auto it = channel.m_notes.begin(); it != channel.m_notes.end();) {
-						auto sp = it->second;
-						if (!sp) throw std::runtime_error("not released note.");	// failsafe
-						auto samples = sp->render(size);
-						if (samples.size() < size)	it = channel.m_notes.erase(it);		// 終わっていればmapから破棄
-						else						it++;
+					for (auto& voice : channel.m_notes) {
+						auto samples = voice.note->render(size);
 						if (resultMono.empty()) {		// 最初なら代入(加算不要)
 							resultMono = std::move(samples);
 						} else {
@@ -631,17 +701,16 @@ namespace rlib::fm {
 							}
 						}
 					}
+					channel.m_notes.eraseIf([](const auto& voice) {
+						return voice.note->isFinished();		// 終わっていれば破棄
+					});
 
-					// 音量処理(channel.m_gain算出)
-					if (!channel.m_gain) {
-						const T n = midi::volumeGainTable<T>[channel.m_volume] * midi::volumeGainTable<T>[channel.m_expression] * (self->m_masterVolume * (static_cast<T>(1.0) / 16383)); // volume,expression,masterVolume
-						const auto& pan = midi::panGainTable<T>[channel.m_pan];
-						channel.m_gain = { n * pan.first, n * pan.second };
-					}
+					// 音量処理
+					const auto& gain = self->getGain(channel);
 					std::vector<midi::StereoSample<T>> result(resultMono.size());
 					for (size_t i = 0; i < result.size(); i++) {
-						result[i].l = resultMono[i] * channel.m_gain->first;
-						result[i].r = resultMono[i] * channel.m_gain->second;
+						result[i].l = resultMono[i] * gain.first;
+						result[i].r = resultMono[i] * gain.second;
 					}
 
 					return result;
@@ -739,13 +808,16 @@ namespace rlib::fm {
 		// Eventはリリース音も含めて全て処理されている状態か
 		bool isSilence()const override {
 			for (auto& ch : m_channels) {
-				if (!ch.m_notes.empty()) return false;
+				if (ch.isActive()) return false;
 			}
 			return true;
 		}
 
-		MidiModuleT(uint32_t sampleRate)
-			: m_renderer(sampleRate)
+		// fidelity:Engine::note のチップの忠実度 (下げるとレンダリングが速くなる)
+		MidiModuleT(uint32_t sampleRate, Engine engine = Engine::note, Fidelity fidelity = Fidelity::max)
+			: m_renderer(sampleRate, fidelity)
+			, m_engine(engine)
+			, m_resampler(FmChip2203::masterClock, FmChip2203::clockDivider, sampleRate)
 			, m_sampleRate(sampleRate)
 		{
 		}
@@ -1,13 +1,49 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
 #include "../ymfm/ymfm_opn.h"
 
 namespace rlib::fm {
 
-	class ChipWrapper2203 : public ymfm::ymfm_interface {
+	// ym2203 の出力の忠実度 (ymfm::opn_fidelity)
+	// 忠実度を下げるとチップの内部サンプリングレートが下がり、1出力サンプルあたりのクロック数が減る
+	enum class Fidelity : uint8_t {
+		min,		// clock/24 (FM 3:1, SSG 2:3)
+		med,		// clock/12 (FM 6:1, SSG 4:3)
+		max,		// clock/4  (FM 18:1, SSG 4:1)
+	};
+
+	inline ymfm::opn_fidelity toOpnFidelity(Fidelity fidelity) {
+		switch (fidelity) {
+		case Fidelity::min:	return ymfm::OPN_FIDELITY_MIN;
+		case Fidelity::med:	return ymfm::OPN_FIDELITY_MED;
+		default:			return ymfm::OPN_FIDELITY_MAX;
+		}
+	}
+
+	// 文字列("min","med","max")から Fidelity へ
+	inline Fidelity toFidelity(std::string_view name) {
+		if (name == "min") return Fidelity::min;
+		if (name == "med") return Fidelity::med;
+		if (name == "max") return Fidelity::max;
+		throw std::runtime_error("unknown fidelity.");
+	}
+
+	// OPN の FM部のレジスタ定義
+	class OpnFm {
 	public:
-		using ChipType = ymfm::ym2203;
 		static constexpr uint32_t masterClock = 3993600;		// マスタークロック (デフォルト分周期でのOPN適正値)
+		static constexpr size_t pitchSteps = 64;				// ピッチの表の半音の分割数 (表の間は線形補間する)
 
 		union Reg28H {
 			struct {
@@ -18,22 +54,8 @@ namespace rlib::fm {
 			uint8_t val = 0;
 		};
 
-		ChipWrapper2203() :
-			m_chip(*this)
-		{
-			// reset
-			m_chip.reset();
-
-			//	m_chip.set_fidelity(ymfm::OPN_FIDELITY_MIN);
-			//	m_chip.write_address(0x2f);
-		}
-
-		void regWrite(uint8_t address, uint8_t val) {
-			m_chip.write(0, address);	// address
-			m_chip.write(1, val);	// data
-		}
-
-		void fmSetPitch(uint8_t note, double pitch = 0.0) {
+		// ノート番号(+ピッチ 半音単位)から block,F-Number のレジスタ値 (bit0～10:F-Number bit11～13:block)
+		static uint16_t getBlockFNumber(uint8_t note, double pitch = 0.0) {
 			constexpr int a4block = 4;				// a4 の block値
 			static const double a4fnumber = [&] {	// a4 の f-number値
 				constexpr double a4feq = 440.0;							// a4は440hzとする
@@ -42,10 +64,25 @@ namespace rlib::fm {
 				return (scale * a4feq * scaleFactor) / masterClock;		// F-Number
 			}();
 
+			// オクターブ内の倍率の表 (C(0.0) ～ 12.0 を半音 pitchSteps 分割)
+			// ノートオン,ピッチベンド毎に std::exp2 を使わないよう表引きする (半音単位のノートは表の値そのまま)
+			static const auto magTable = [] {
+				std::array<double, 12 * pitchSteps + 1> table;
+				for (size_t i = 0; i < table.size(); i++) {
+					table[i] = std::exp2((static_cast<double>(i) / pitchSteps - 9) * (1.0 / 12));	// 倍率 ( 9 は CからAへの差 )
+				}
+				return table;
+			}();
+
 			const double fnote = note + pitch;
 			const int octave = static_cast<int>(fnote) / 12;			// octave(block)
 			const double local = fnote - (octave * 12);					// C(0.0) ～ B(11.0) ～ 12.0未満 
-			const auto mag = std::exp2((local - 9) * (1.0 / 12));		// 倍率 ( 9 は CからAへの差 )
+			const auto mag = [&] {
+				if (local < 0) return std::exp2((local - 9) * (1.0 / 12));		// 負のノート(表の範囲外)
+				const double position = local * pitchSteps;
+				const auto index = (std::min)(static_cast<size_t>(position), magTable.size() - 2);
+				return magTable[index] + (magTable[index + 1] - magTable[index]) * (position - index);
+			}();
 			const auto fnumber = a4fnumber * mag;
 
 			//static const std::vector<uint16_t> freqTable{ 0x26a, 0x28f, 0x2b6, 0x2df, 0x30b, 0x339, 0x36a, 0x39e, 0x3d5, 0x410, 0x44e, 0x48f };
@@ -58,34 +95,13 @@ namespace rlib::fm {
 					uint16_t	block : 3;
 					uint16_t	none : 2;
 				};
-				uint8_t val[2] = { 0 };
+				uint16_t val = 0;
 			};
 
 			BlockFNumber bf{ 0 };
 			bf.fnumber = static_cast<decltype(bf.fnumber)>(std::round(fnumber));
 			bf.block = octave - 1;
-
-			uint8_t channel = 0;	// チャンネルは0のみ使用
-			const uint8_t addrL = 0xa0 + channel;
-			const uint8_t addrH = 0xa4 + channel;
-			regWrite(addrH, bf.val[1]);
-			regWrite(addrL, bf.val[0]);
-
-		}
-
-		void fmNoteOn() {
-			uint8_t channel = 0;	// チャンネルは0のみ使用
-			Reg28H r;
-			r.slot = 0xf;
-			r.channel = channel;
-			regWrite(0x28, r.val);
-		}
-
-		void fmNoteOff() {
-			uint8_t channel = 0;	// チャンネルは0のみ使用
-			Reg28H r;
-			r.channel = channel;
-			regWrite(0x28, r.val);
+			return bf.val;
 		}
 
 		struct FmProgramReg {
@@ -148,12 +164,58 @@ namespace rlib::fm {
 				uint8_t val = 0;
 			};
 		};
+	};
+
+	// OPN の FM部のレジスタ設定 (Derived::regWrite(address, val) で書き込む)
+	template <typename Derived> class OpnFmRegisterT : public OpnFm {
+		void write(uint8_t address, uint8_t val) {
+			static_cast<Derived&>(*this).regWrite(address, val);
+		}
+	public:
+		// channel:0～2
+		void fmSetPitch(uint8_t note, double pitch = 0.0, uint8_t channel = 0) {
+			const uint16_t blockFNumber = getBlockFNumber(note, pitch);
+			const uint8_t addrL = 0xa0 + channel;
+			const uint8_t addrH = 0xa4 + channel;
+			write(addrH, static_cast<uint8_t>(blockFNumber >> 8));
+			write(addrL, static_cast<uint8_t>(blockFNumber & 0xff));
+
+		}
+
+		void fmNoteOn(uint8_t channel = 0) {
+			Reg28H r;
+			r.slot = 0xf;
+			r.channel = channel;
+			write(0x28, r.val);
+		}
+
+		void fmNoteOff(uint8_t channel = 0) {
+			Reg28H r;
+			r.channel = channel;
+			write(0x28, r.val);
+		}
+
+		// チャンネルの全キャリア(出力に加算されるオペレータ)が無音レベルまで減衰したか
+		// ディケイ以降(ディケイ,サステイン,リリース)の減衰量は次のキーオンまで増える一方なので、以降の出力はほぼ0のまま。クロックを止めてよい
+		bool fmIsIdle(uint8_t channel = 0) {
+			static constexpr uint8_t carriers[8] = { 0b1000, 0b1000, 0b1000, 0b1000, 0b1010, 0b1110, 0b1110, 0b1111 };	// アルゴリズム毎のキャリア (bit0～3:op1～op4)
+			static constexpr uint16_t quietAttenuation = 0x380;		// ymfm が発音終了とみなす減衰量 (fm_operator::EG_QUIET)
+			auto& engine = static_cast<Derived*>(this)->fmEngine();
+			const auto* ch = engine.debug_channel(channel);
+			const uint8_t mask = carriers[engine.regs().ch_algorithm(channel)];
+			for (uint8_t op = 0; op < 4; op++) {
+				if (!(mask & (1u << op))) continue;
+				const auto* ope = ch->debug_operator(op);		// op1～op4 の順
+				const auto state = ope->debug_eg_state();
+				if (state == ymfm::EG_DEPRESS || state == ymfm::EG_ATTACK || ope->debug_eg_attenuation() < quietAttenuation) return false;
+			}
+			return true;
+		}
 
-		void fmSetProgram(const FmProgramReg& program) {
-			constexpr uint8_t channel = 0;	// チャンネルは0のみ使用
+		void fmSetProgram(const FmProgramReg& program, uint8_t channel = 0) {
 			for (size_t i = 0; i < std::size(program.ope); i++) {
 				const auto reg = [&](auto addr, auto val) {
-					regWrite(static_cast<uint8_t>(addr + (i * 4) + channel), val);
+					write(static_cast<uint8_t>(addr + (i * 4) + channel), val);
 				};
 				const auto& ope = program.ope[([i] {
 					constexpr size_t a[] = { 0, 2, 1, 3 };
@@ -191,24 +253,88 @@ namespace rlib::fm {
 			reg::FbAl fbal;
 			fbal.algorhythm = program.al;
 			fbal.feedBack = program.fb;
-			regWrite(static_cast<uint8_t>(0xb0 + channel), fbal.val);
+			write(static_cast<uint8_t>(0xb0 + channel), fbal.val);
 
 		}
+	};
+
+	// ym2203 (FM部 + SSG部) 1ノートに1チップ使い、チャンネルは0のみ使用する
+	class ChipWrapper2203 : public ymfm::ymfm_interface, public OpnFmRegisterT<ChipWrapper2203> {
+	public:
+		using ChipType = ymfm::ym2203;
+
+		ChipWrapper2203(Fidelity fidelity = Fidelity::max) :
+			m_chip(*this)
+		{
+			// reset
+			m_chip.reset();
+
+			m_chip.set_fidelity(toOpnFidelity(fidelity));
+			//	m_chip.write_address(0x2f);
+		}
+
+		void regWrite(uint8_t address, uint8_t val) {
+			m_chip.write(0, address);	// address
+			m_chip.write(1, val);	// data
+		}
+
+		ymfm::ym2203::fm_engine& fmEngine() {
+			return static_cast<ymfm::ym2203::fm_engine&>(*m_engine);		// ym2203 内の FM部 (ymfm_interface に登録されている)
+		}
+
+		// チップの内部状態(レジスタ,エンベロープ,位相等)の保存と復元
+		std::vector<uint8_t> saveState() {
+			std::vector<uint8_t> state;
+			ymfm::ymfm_saved_state saved(state, true);
+			m_chip.save_restore(saved);
+			return state;
+		}
+		void restoreState(std::vector<uint8_t>& state) {
+			ymfm::ymfm_saved_state saved(state, false);
+			m_chip.save_restore(saved);
+		}
 
 
 		// MIDIノート番号(小数点以下はセント単位のずれ)からトーン周期レジスタを算出して書き込む
-		void psgSetPitch(uint8_t note, double pitch = 0.0) {
-			constexpr uint8_t channel = 0;		// チャンネルは0(A)のみ使用
-			
+		// ノート番号からトーン周期(レジスタ値)へ
+		static uint32_t psgPeriod(uint8_t note, double pitch = 0.0) {
 			constexpr double a4note = 69.0;		// A4のノート番号(MIDI標準)
 			constexpr double a4freq = 440.0;	// A4は440Hzとする
+			const auto getPeriod = [](double fnote) {
+				const double freq = a4freq * std::pow(2.0, (fnote - a4note) * (1.0 / 12.0));
+
+				// freq = masterClock / (8 × 内蔵分周器の分周数(4) × period ) ⇔ period = masterClock / (32 × freq)
+				return masterClock / (32.0 * freq);
+			};
+
+			// ノート毎の周期の表と、半音未満のピッチによる周期の倍率の表 (半音を pitchSteps 分割)
+			// ノートオン,ピッチベンド毎に std::pow を使わないよう表引きする (半音単位のノートは表の値そのまま)
+			static const auto periodTable = [&] {
+				std::array<double, 128> table;
+				for (size_t i = 0; i < table.size(); i++) table[i] = getPeriod(static_cast<double>(i));
+				return table;
+			}();
+			static const auto fractionTable = [] {
+				std::array<double, pitchSteps + 1> table;
+				for (size_t i = 0; i < table.size(); i++) table[i] = std::pow(2.0, -(static_cast<double>(i) / pitchSteps) * (1.0 / 12.0));
+				return table;
+			}();
+
 			const double fnote = note + pitch;
-			const double freq = a4freq * std::pow(2.0, (fnote - a4note) * (1.0 / 12.0));
+			const double periodF = [&] {
+				if (!(fnote >= 0 && fnote < periodTable.size())) return getPeriod(fnote);		// 表の範囲外
+				const auto n = static_cast<size_t>(fnote);
+				const double position = (fnote - n) * pitchSteps;
+				const auto index = (std::min)(static_cast<size_t>(position), fractionTable.size() - 2);
+				return periodTable[n] * (fractionTable[index] + (fractionTable[index + 1] - fractionTable[index]) * (position - index));
+			}();
+			const uint32_t period = static_cast<uint32_t>(std::llround(periodF));
+			return std::clamp<uint32_t>(period, 1, 0xfff);	// 12bitレジスタ
+		}
 
-			// freq = masterClock / (8 × 内蔵分周器の分周数(4) × period ) ⇔ period = masterClock / (32 × freq)
-			const double periodF = masterClock / (32.0 * freq);
-			uint32_t period = static_cast<uint32_t>(std::llround(periodF));
-			period = std::clamp<uint32_t>(period, 1, 0xfff);	// 12bitレジスタ
+		void psgSetPitch(uint8_t note, double pitch = 0.0) {
+			constexpr uint8_t channel = 0;		// チャンネルは0(A)のみ使用
+			const uint32_t period = psgPeriod(note, pitch);
 
 			regWrite(channel * 2 + 0x00, static_cast<uint8_t>(period & 0xff));
 			regWrite(channel * 2 + 0x01, static_cast<uint8_t>((period >> 8) & 0x0f));
@@ -250,6 +376,95 @@ namespace rlib::fm {
 		ChipType m_chip;
 	};
 
+	// OPN の FM部のみ (SSG部を持たない) 3チャンネルをそれぞれ別のボイスとして使う
+	class FmChip2203 : public ymfm::ymfm_interface, public OpnFmRegisterT<FmChip2203> {
+	public:
+		using EngineType = ymfm::fm_engine_base<ymfm::opn_registers>;
+		static constexpr uint8_t channelCount = 3;
+		static constexpr uint32_t clockDivider = 6 * EngineType::OPERATORS;		// 1出力あたりのマスタークロック数 (プリスケーラ 1/6 × オペレータ数)
+		using Outputs = std::array<int32_t, channelCount>;
+
+		FmChip2203() :
+			m_engine(*this)
+		{
+			m_engine.reset();
+		}
+		FmChip2203(const FmChip2203&) = delete;
+		FmChip2203& operator=(const FmChip2203&) = delete;
+
+		void regWrite(uint8_t address, uint8_t val) {
+			m_engine.write(address, val);
+		}
+
+		EngineType& fmEngine() {
+			return m_engine;
+		}
+
+		// count サンプル進め、チャンネル毎の出力を outputs[0～count-1] へ (chanmask:対象チャンネルのビットマスク)
+		// チャンネル毎にアルゴリズム別のループでまとめて進める (EngineType::clock_block)
+		void clock(uint32_t chanmask, Outputs* outputs, size_t count) {
+			for (size_t i = 0; i < count; ) {
+				const auto samples = static_cast<uint32_t>((std::min<size_t>)(count - i, EngineType::MAX_BLOCK_SAMPLES));
+				for (size_t n = 0; n < samples * channelCount; n++) m_block[n].clear();
+				const uint32_t done = m_engine.clock_block(chanmask, m_block.data(), samples, 0, 32767);	// OPN は途中のクリップ無しの14bit
+				for (uint32_t n = 0; n < done; n++, i++) {
+					for (uint8_t ch = 0; ch < channelCount; ch++) {
+						if (!(chanmask & (1u << ch))) continue;
+						outputs[i][ch] = m_block[n * channelCount + ch].roundtrip_fp().data[0];		// DAC(10.3浮動小数点)を経由した値
+					}
+				}
+			}
+		}
+
+	private:
+		EngineType	m_engine;
+		std::array<EngineType::output_data, EngineType::MAX_BLOCK_SAMPLES * channelCount>	m_block;		// clock_block の出力 [サンプル][チャンネル]
+	};
+
+	// チップのクロックと出力サンプルの対応 (出力サンプリングレートへの間引き)
+	// 出力サンプル J(0～) には ceil((J+1) × 1サンプルあたりのクロック数) 回目のクロックの出力を用いる
+	// チップはブロック単位でまとめてクロックし、ブロック内の位置(indexes)から間引いて出力する
+	class ClockSchedule {
+		const uintmax_t			m_clock;			// 出力1サンプルあたりのクロック数 = m_clock / m_divider
+		const uintmax_t			m_divider;
+		uintmax_t				m_clockCount = 0;	// 実施済クロック数
+		uintmax_t				m_outputCount = 0;	// 出力済サンプル数
+		std::vector<uint32_t>	m_indexes;
+
+		// 出力サンプル count 個を得るのに必要なクロック数
+		uintmax_t getClockCount(uintmax_t count)const {
+			return (count * m_clock + m_divider - 1) / m_divider;
+		}
+	public:
+		struct Block {
+			size_t		outputs;	// 出力サンプル数
+			size_t		clocks;		// クロック数
+		};
+
+		// chipClock:チップに与えるクロック(Hz) clockDivider:チップの1クロックあたりの chipClock 数
+		ClockSchedule(uint32_t chipClock, uint32_t clockDivider, uint32_t sampleRate)
+			: m_clock(chipClock)
+			, m_divider(static_cast<uintmax_t>(clockDivider) * sampleRate)
+		{}
+
+		// 次のブロック (出力は最大 maxOutputs 個、クロック数は maxClocks 以下。ただし最低1サンプルは出力する)
+		Block next(size_t maxOutputs, size_t maxClocks) {
+			const uintmax_t limit = (m_clockCount + maxClocks) * m_divider / m_clock;	// maxClocks 以内で得られる出力サンプル数(累計)
+			const size_t outputs = static_cast<size_t>((std::clamp<uintmax_t>)(limit - (std::min)(limit, m_outputCount), 1, maxOutputs));
+			m_indexes.resize(outputs);
+			for (size_t i = 0; i < outputs; i++) {
+				m_indexes[i] = static_cast<uint32_t>(getClockCount(m_outputCount + i + 1) - 1 - m_clockCount);
+			}
+			const size_t clocks = static_cast<size_t>(getClockCount(m_outputCount + outputs) - m_clockCount);
+			m_outputCount += outputs;
+			m_clockCount += clocks;
+			return Block{ outputs, clocks };
+		}
+
+		// 直前の next() で得たブロックの、出力サンプル毎のブロック内のクロック位置
+		const std::vector<uint32_t>& indexes()const { return m_indexes; }
+	};
+
 	template <typename T = double> class RendererT {
 	public:
 		struct PresetKey {
@@ -260,68 +475,122 @@ namespace rlib::fm {
 
 	public:
 		const uint32_t	m_sampleRate;
+		const Fidelity	m_fidelity;		// Note のチップの忠実度 (ChipPool は FM部のみを直接クロックするので影響しない)
+		static constexpr size_t blockClocks = 1024;		// チップをまとめてクロックする単位
 
-		RendererT(uint32_t sampleRate)
+		RendererT(uint32_t sampleRate, Fidelity fidelity = Fidelity::max)
 			:m_sampleRate(sampleRate)
+			, m_fidelity(fidelity)
 		{
 		}
 		RendererT(const RendererT&) = delete;
 		RendererT& operator=(const RendererT&) = delete;
 
+	private:
+		// Note のチップの再利用
+		// チップの生成(内部のチャンネル,オペレータの確保)と音色のレジスタ書き込みをノートオン毎に行わないよう、
+		// 発音を終えたチップをプールし、音色毎に「リセット直後のチップへ音色を設定した状態」を保存しておいて復元する
+		// (状態を丸ごと復元するので、新しいチップに音色を設定した場合と同じ出力になる)
+		using ProgramKey = std::array<uint8_t, sizeof(ChipWrapper2203::FmProgramReg)>;
+		std::map<ProgramKey, std::vector<uint8_t>>		m_programStates;	// 音色毎の設定済のチップの状態 (ノートオンからのみ使用)
+		std::vector<std::unique_ptr<ChipWrapper2203>>	m_chips;			// 未使用のチップ
+		std::mutex										m_chipsMutex;		// m_chips 用 (Note の破棄はチャンネル毎のスレッドで行われる)
+
+		// 音色を設定済のチップを得る
+		std::unique_ptr<ChipWrapper2203> acquireChip(const ChipWrapper2203::FmProgramReg& program) {
+			static_assert(std::is_trivially_copyable_v<ChipWrapper2203::FmProgramReg>);
+			ProgramKey key;
+			std::memcpy(key.data(), &program, key.size());
+			auto& state = m_programStates[key];
+			if (state.empty()) {		// 初めての音色なら新しいチップに設定して状態を保存
+				ChipWrapper2203 chip(m_fidelity);
+				chip.fmSetProgram(program);
+				state = chip.saveState();
+			}
+
+			std::unique_ptr<ChipWrapper2203> chip;
+			{
+				std::lock_guard lock(m_chipsMutex);
+				if (!m_chips.empty()) {
+					chip = std::move(m_chips.back());
+					m_chips.pop_back();
+				}
+			}
+			if (!chip) chip = std::make_unique<ChipWrapper2203>(m_fidelity);
+			chip->restoreState(state);
+			return chip;
+		}
+
+		void releaseChip(std::unique_ptr<ChipWrapper2203> chip) {
+			std::lock_guard lock(m_chipsMutex);
+			m_chips.push_back(std::move(chip));
+		}
+
+	public:
+
 		class Note {
 			friend class RendererT;
 		public:
 			RendererT& m_renderer;
 			const PresetKey m_presetKey;
 		private:
-			ChipWrapper2203				m_chip;
+			std::unique_ptr<ChipWrapper2203>	m_chip;			// 音色設定済のチップ (RendererT からの借用。破棄時に返却する)
 			bool						m_keyoff = false;
+			bool						m_finished = false;		// 発音完了
 			const T						m_amplitude;			// 16bitからT型へ変換する係数(velocity値から)
-			uintmax_t					m_clockCount = 0;		// 実施済クロック数
+			ClockSchedule				m_schedule;
+			std::vector<typename ChipWrapper2203::ChipType::output_data>	m_buffer;		// ブロック単位のチップ出力
 			size_t						m_silenceCount = 0;
 		private:
 			Note(RendererT& renderer, const PresetKey& presetKey, const ChipWrapper2203::FmProgramReg& program, double pitch)
 				: m_renderer(renderer)
 				, m_presetKey(presetKey)
+				, m_chip(renderer.acquireChip(program))
 				, m_amplitude((static_cast<T>(1.0) / 32767)* midi::volumeGainTable<T>[presetKey.velocity])
+				, m_schedule(ChipWrapper2203::masterClock, ChipWrapper2203::masterClock / m_chip->m_chip.sample_rate(ChipWrapper2203::masterClock), renderer.m_sampleRate)
 			{
-				m_chip.fmSetProgram(program);
-				m_chip.fmSetPitch(presetKey.note, presetKey.fineTune + pitch);
-				m_chip.fmNoteOn();
+				m_chip->fmSetPitch(presetKey.note, presetKey.fineTune + pitch);
+				m_chip->fmNoteOn();
 			}
 		public:
 			Note(Note&&) = default;
 			Note(const Note&) = delete;
 			Note& operator=(const Note&) = delete;
+			~Note() {
+				if (m_chip) m_renderer.releaseChip(std::move(m_chip));
+			}
 
 			void setPitchBend(double pitch) {
-				m_chip.fmSetPitch(m_presetKey.note, m_presetKey.fineTune + pitch);
+				m_chip->fmSetPitch(m_presetKey.note, m_presetKey.fineTune + pitch);
 			}
 
-			//// レンダリング（結果配列がsize未満なら完了）旧愚直コード
+			// レンダリング（結果配列がsize未満なら完了）
+			// チップはブロック単位(blockClocks クロック程度)でまとめて生成し、出力サンプル毎に間引く
 			std::vector<T> render(size_t size) {
 				std::vector<T> result(size);
-				auto& chip = m_chip.m_chip;
-				const auto sr = chip.sample_rate(ChipWrapper2203::masterClock);					// 1秒あたりのクロック数		3,993,600/4 = 998,400
-				const T n = static_cast<T>(m_renderer.m_sampleRate) / sr;		// 1クロックあたりのサンプル数	44,100/998,400 = 0.04417
-				uintmax_t before = static_cast<uintmax_t>(m_clockCount * n);	// 読み出し済の位置(サンプルあたり)
-				for (size_t outCount = 0; true;) {
-					typename decltype(m_chip)::ChipType::output_data output;
-					chip.generate(&output, 1);
-					const uintmax_t current = static_cast<uintmax_t>((++m_clockCount) * n);	// 読み出し済の位置(サンプルあたり)
-					if (before != current) {									// 出力タイミング？
-						const int32_t out = output.data[0];				// FM
+				auto& chip = m_chip->m_chip;
+				for (size_t outCount = 0; outCount < size;) {
+					const auto block = m_schedule.next(size - outCount, blockClocks);
+					m_buffer.resize(block.clocks);
+					chip.generate(m_buffer.data(), static_cast<uint32_t>(block.clocks));
+					for (const auto index : m_schedule.indexes()) {
+						const int32_t out = m_buffer[index].data[0];		// FM
 						if (out == 0) {
 							if (m_keyoff && ++m_silenceCount > 16) {	// 発音完了？
 								result.resize(outCount);
-								break;
+								m_finished = true;
+								return result;
 							}
 						} else {
 							m_silenceCount = 0;
 							result[outCount] = out * m_amplitude;		// -1.0～1.0 へ変換(veloctiy込み)
 						}
-						if (++outCount >= size) break;
-						before = current;
+						outCount++;
+					}
+					if (m_chip->fmIsIdle()) {		// エンベロープが減衰しきっていれば発音完了
+						result.resize(outCount);
+						m_finished = true;
+						return result;
 					}
 				}
 				return result;
@@ -350,7 +619,11 @@ namespace rlib::fm {
 
 			void setKeyoff() {
 				m_keyoff = true;
-				m_chip.fmNoteOff();
+				m_chip->fmNoteOff();
+			}
+
+			bool isFinished()const {
+				return m_finished;
 			}
 
 		};
@@ -359,6 +632,551 @@ namespace rlib::fm {
 			return std::shared_ptr<Note>(new Note(*this, presetKey, program, pitch));
 		}
 
+		// FM部のみのチップを複数ボイスで共有するプール (MIDIチャンネル毎に1つ)
+		// 実機の OPN と同様に1チップの3チャンネルへボイスを割り当て、空きが無い時だけチップを追加する
+		// (Note と異なり SSG部を持たず、発音中のチャンネルのみクロックする)
+		class ChipPool {
+			struct Voice {
+				uint8_t		key;					// ノートオン時の MIDIノート番号
+				PresetKey	presetKey;
+				T			amplitude;				// 16bitからT型へ変換する係数(velocity値から)
+				bool		keyoff = false;
+				size_t		silenceCount = 0;
+			};
+			struct Chip {
+				std::unique_ptr<FmChip2203>		chip = std::make_unique<FmChip2203>();
+				std::array<std::optional<Voice>, FmChip2203::channelCount>	voices;
+				std::vector<FmChip2203::Outputs>	outputs;		// ブロック単位のチャンネル毎の出力
+				uint8_t							keyon = 0;			// キーオン中のチャンネル(ビットマスク)
+				uint8_t							keyonClocked = 0;	// 最後のクロックでキーオンが反映済のチャンネル(チップ内部のキー状態)
+				uint8_t							keyonPending = 0;	// 次のクロック後にキーオンするチャンネル(キーオン中のチャンネルを再度キーオンする場合)
+				uint8_t							keyonUnclocked = 0;	// ブロックの最後のクロック後にキーオンしたチャンネル(エンベロープの状態が未反映)
+
+				void noteOn(uint8_t ch) {
+					chip->fmNoteOn(ch);
+					keyon |= 1u << ch;
+				}
+				void noteOff(uint8_t ch) {
+					chip->fmNoteOff(ch);
+					keyon &= ~(1u << ch);
+					keyonPending &= ~(1u << ch);
+				}
+
+				uint32_t getChannelMask()const {
+					uint32_t mask = 0;
+					for (uint8_t ch = 0; ch < voices.size(); ch++) {
+						if (voices[ch]) mask |= 1u << ch;
+					}
+					return mask;
+				}
+			};
+			RendererT&			m_renderer;
+			std::vector<Chip>	m_chips;
+
+			template <typename F> void forVoices(F f) {
+				for (auto& chip : m_chips) {
+					for (uint8_t ch = 0; ch < chip.voices.size(); ch++) {
+						if (chip.voices[ch]) f(chip, ch, *chip.voices[ch]);
+					}
+				}
+			}
+		public:
+			ChipPool(RendererT& renderer)
+				: m_renderer(renderer)
+			{}
+			ChipPool(const ChipPool&) = delete;
+			ChipPool& operator=(const ChipPool&) = delete;
+
+			// ノートオン (同一キーの発音は置き換える)
+			void noteOn(uint8_t key, const PresetKey& presetKey, const ChipWrapper2203::FmProgramReg& program, double pitch) {
+				const auto slot = [&]()->std::pair<Chip*, uint8_t> {
+					std::optional<std::pair<Chip*, uint8_t>> empty;
+					for (auto& chip : m_chips) {
+						for (uint8_t ch = 0; ch < chip.voices.size(); ch++) {
+							if (chip.voices[ch] && chip.voices[ch]->key == key) return { &chip, ch };		// 同一キーのチャンネルを再利用
+							if (!chip.voices[ch] && !empty) empty = { &chip, ch };
+						}
+					}
+					if (empty) return *empty;
+					return { &m_chips.emplace_back(), 0 };		// 空きが無ければチップを追加
+				}();
+				auto& [chip, ch] = slot;
+				chip->voices[ch] = Voice{ key, presetKey, (static_cast<T>(1.0) / 32767) * midi::volumeGainTable<T>[presetKey.velocity] };
+				// キーオフ→キーオンの間にクロックが無いとキーオンとみなされない
+				// 同じ位置のノートオフ→ノートオンでは keyon は既に落ちているので、チップに反映済のキー状態で判定する
+				const bool retrigger = ((chip->keyon | chip->keyonClocked) & (1u << ch)) != 0;
+				chip->noteOff(ch);
+				chip->chip->fmSetProgram(program, ch);
+				chip->chip->fmSetPitch(presetKey.note, presetKey.fineTune + pitch, ch);
+				if (retrigger) {
+					chip->keyonPending |= 1u << ch;
+				} else {
+					chip->noteOn(ch);
+				}
+			}
+
+			void noteOff(uint8_t key) {
+				forVoices([key](Chip& chip, uint8_t ch, Voice& voice) {
+					if (voice.key != key || voice.keyoff) return;
+					voice.keyoff = true;
+					chip.noteOff(ch);
+				});
+			}
+
+			void setPitchBend(double pitch) {
+				forVoices([pitch](Chip& chip, uint8_t ch, Voice& voice) {
+					chip.chip->fmSetPitch(voice.presetKey.note, voice.presetKey.fineTune + pitch, ch);
+				});
+			}
+
+			// レンダリング(モノラル チップのサンプリングレート(masterClock / clockDivider)のまま 結果配列がsize未満なら全ボイス完了)
+			// 出力サンプリングレートへの変換は呼び出し側(モジュールで1つの Resampler)で行う
+			std::vector<T> render(size_t size) {
+				std::vector<T> result(size);
+				size_t resultSize = 0;
+				for (size_t offset = 0; offset < size;) {
+					const size_t clocks = (std::min)(size - offset, blockClocks);
+					for (auto& chip : m_chips) {
+						const auto mask = chip.getChannelMask();
+						if (!mask) continue;
+						chip.outputs.resize(clocks);
+						chip.keyonUnclocked = 0;
+						size_t clocked = 0;
+						if (chip.keyonPending) {		// 保留中のキーオンは最初のクロックの後
+							chip.chip->clock(mask, chip.outputs.data(), 1);
+							clocked = 1;
+							if (clocks == 1) chip.keyonUnclocked = chip.keyonPending;
+							for (uint8_t ch = 0; chip.keyonPending; ch++) {
+								if (chip.keyonPending & (1u << ch)) {
+									chip.keyonPending &= ~(1u << ch);
+									chip.noteOn(ch);
+								}
+							}
+						}
+						chip.chip->clock(mask, chip.outputs.data() + clocked, clocks - clocked);
+						chip.keyonClocked = static_cast<uint8_t>((chip.keyonClocked & ~mask) | (chip.keyon & ~chip.keyonUnclocked & mask));	// クロックしたチャンネルのみ反映される
+					}
+					forVoices([&](Chip& chip, uint8_t ch, Voice& voice) {
+						T* dst = result.data() + offset;
+						for (size_t i = 0; i < clocks; i++) {
+							const int32_t out = chip.outputs[i][ch];
+							if (out == 0) {
+								if (voice.keyoff && ++voice.silenceCount > 16) {	// 発音完了？
+									resultSize = (std::max)(resultSize, offset + i);
+									chip.voices[ch].reset();
+									return;
+								}
+							} else {
+								voice.silenceCount = 0;
+								dst[i] += out * voice.amplitude;		// -1.0～1.0 へ変換(veloctiy込み)
+							}
+						}
+						resultSize = offset + clocks;
+						if (!(chip.keyonUnclocked & (1u << ch)) && chip.chip->fmIsIdle(ch)) {		// エンベロープが減衰しきっていれば発音完了
+							chip.voices[ch].reset();
+						}
+					});
+					offset += clocks;
+				}
+				result.resize(resultSize);
+				return result;
+			}
+
+			bool empty()const {
+				return std::none_of(m_chips.begin(), m_chips.end(), [](const Chip& chip) { return chip.getChannelMask() != 0; });
+			}
+		};
+
+		std::unique_ptr<ChipPool> createChipPool() {
+			return std::make_unique<ChipPool>(*this);
+		}
+
+		// FM部を全ボイス分の SoA 配列で持ち、全ボイスを1クロックずつ揃えて進めるエンジン (MIDIチャンネル毎に1つ)
+		// ymfm の OPN のオペレータ(位相,エンベロープ,sin/指数テーブル,フィードバック,アルゴリズム)を移植したもので、
+		// ボイス数だけチャンネルを持つ1つのチップと同じ出力になる (エンベロープのカウンタは全ボイスで共有)
+		// 音色は ChipWrapper2203::FmProgramReg をそのまま使う (ym2203 に無い SSG-EG, LFO は扱わない)
+		class VoiceEngine {
+			static constexpr uint32_t quietAttenuation = 0x380;		// 発音終了とみなす減衰量 (fm_operator::EG_QUIET)
+
+			// アルゴリズム毎の接続 (ymfm の s_fm_algorithm_ops と同じ)
+			// opNin: 変調入力にする opout の添字 (0:無し 1～3:op1～op3 4:未使用 5:op1+op2 6:op1+op3 7:op2+op3)
+			// outputs: op4 に加えて出力するオペレータ (bit0～2:op1～op3)
+			struct Algorithm {
+				uint8_t	op2in, op3in, op4in, outputs;
+			};
+			static constexpr Algorithm algorithms[8] = {
+				{ 1, 2, 3, 0b000 },		// O1 -> O2 -> O3 -> O4 -> out (O4)
+				{ 0, 5, 3, 0b000 },		// (O1 + O2) -> O3 -> O4 -> out (O4)
+				{ 0, 2, 6, 0b000 },		// (O1 + (O2 -> O3)) -> O4 -> out (O4)
+				{ 1, 0, 7, 0b000 },		// ((O1 -> O2) + O3) -> O4 -> out (O4)
+				{ 1, 0, 3, 0b010 },		// ((O1 -> O2) + (O3 -> O4)) -> out (O2+O4)
+				{ 1, 1, 1, 0b110 },		// ((O1 -> O2) + (O1 -> O3) + (O1 -> O4)) -> out (O2+O3+O4)
+				{ 1, 0, 0, 0b110 },		// ((O1 -> O2) + O3 + O4) -> out (O2+O3+O4)
+				{ 0, 0, 0, 0b111 },		// (O1 + O2 + O3 + O4) -> out (O1+O2+O3+O4)
+			};
+
+			struct Voice {
+				uint8_t		key;					// ノートオン時の MIDIノート番号
+				PresetKey	presetKey;
+				T			amplitude;				// 16bitからT型へ変換する係数(velocity値から)
+				ChipWrapper2203::FmProgramReg	program;
+				bool		keyoff = false;
+				size_t		silenceCount = 0;
+				bool		keyLive = false;		// キーオン要求 (次のクロックの最初に反映する)
+				bool		keyState = false;		// 反映済のキー状態
+				bool		keyonPending = false;	// 次のクロック後にキーオンする(キーオン中のボイスを再度キーオンする場合)
+			};
+
+			// オペレータ(op1～op4)毎の状態 [ボイス]
+			struct Operators {
+				std::vector<uint32_t>	phase;			// 10.10 の位相
+				std::vector<uint32_t>	phaseStep;
+				std::vector<uint16_t>	attenuation;	// エンベロープの減衰量 (4.6)
+				std::vector<uint16_t>	totalLevel;		// TL << 3
+				std::vector<uint16_t>	sustain;		// サステインレベルの減衰量
+				std::vector<uint8_t>	state;			// ymfm::envelope_state
+				std::array<std::vector<uint8_t>, ymfm::EG_STATES>	rate;	// 状態毎のエンベロープのレート (KSR込み)
+
+				template <typename F> void forArrays(F f) {
+					f(phase); f(phaseStep); f(attenuation); f(totalLevel); f(sustain); f(state);
+					for (auto& r : rate) f(r);
+				}
+			};
+
+			RendererT&				m_renderer;
+			std::vector<Voice>		m_voices;
+			std::array<Operators, 4>	m_ops;
+			// チャンネル毎の状態 [ボイス]
+			std::vector<int16_t>	m_feedback0, m_feedback1, m_feedbackIn;		// op1 のフィードバック
+			std::vector<uint8_t>	m_feedbackShift;	// (sum >> shift) 10 - FB
+			std::vector<int32_t>	m_feedbackMask;		// FB=0 なら 0 (フィードバック無し)
+			std::vector<uint8_t>	m_op2in, m_op3in, m_op4in, m_outputs;		// Algorithm
+			double					m_pitch = 0.0;		// ピッチベンド(半音単位)
+			uint32_t				m_envCounter = 0;	// エンベロープのカウンタ (x.2)
+			bool					m_keyChanged = false;
+			bool					m_keyonPending = false;		// keyonPending のボイスがあるか
+			std::vector<int16_t>	m_opout;			// オペレータの出力 [opout の添字][ボイス]
+			std::vector<int32_t>	m_block;			// ブロック単位のボイス毎の出力 [クロック][ボイス]
+
+			template <typename F> void forArrays(F f) {
+				for (auto& ops : m_ops) ops.forArrays(f);
+				f(m_feedback0); f(m_feedback1); f(m_feedbackIn); f(m_feedbackShift); f(m_feedbackMask);
+				f(m_op2in); f(m_op3in); f(m_op4in); f(m_outputs);
+			}
+
+			// 1周期1024の sin の減衰量 (ymfm::opn_registers の波形と同じ bit15:符号)
+			static const std::array<uint16_t, 1024>& waveform() {
+				static const std::array<uint16_t, 1024> table = [] {
+					std::array<uint16_t, 1024> t;
+					for (uint32_t i = 0; i < t.size(); i++) t[i] = static_cast<uint16_t>(ymfm::abs_sin_attenuation(i) | (ymfm::bitfield(i, 9) << 15));
+					return t;
+				}();
+				return table;
+			}
+
+			// 5.8 の減衰量から13bitの振幅 (ymfm::attenuation_to_volume の全入力分  sin の減衰量(最大0x859) + エンベロープ(最大0xffc))
+			static const std::array<uint16_t, 0x2000>& volumes() {
+				static const std::array<uint16_t, 0x2000> table = [] {
+					std::array<uint16_t, 0x2000> t;
+					for (uint32_t i = 0; i < t.size(); i++) t[i] = static_cast<uint16_t>(ymfm::attenuation_to_volume(i));
+					return t;
+				}();
+				return table;
+			}
+
+			static uint32_t effectiveRate(uint32_t rawrate, uint32_t ksr) {
+				return (rawrate == 0) ? 0 : (std::min<uint32_t>)(rawrate + ksr, 63);
+			}
+
+			// 音色と block,F-Number から位相,エンベロープのパラメータを設定 (opn_registers::cache_operator_data と同じ)
+			void cache(size_t v) {
+				const auto& voice = m_voices[v];
+				const uint32_t blockFreq = ChipWrapper2203::getBlockFNumber(voice.presetKey.note, voice.presetKey.fineTune + m_pitch);
+				uint32_t keycode = ymfm::bitfield(blockFreq, 10, 4) << 1;
+				keycode |= ymfm::bitfield(0xfe80, ymfm::bitfield(blockFreq, 7, 4));
+				const uint32_t fnum = ymfm::bitfield(blockFreq, 0, 11) << 1;
+				const uint32_t block = ymfm::bitfield(blockFreq, 11, 3);
+				for (size_t op = 0; op < m_ops.size(); op++) {
+					const auto& ope = voice.program.ope[op];
+					auto& ops = m_ops[op];
+					const uint32_t multiple = (ope.ml & 0xf) ? (ope.ml & 0xf) * 2 : 1;		// x.1 (0 は 0.5)
+					const uint32_t step = (((fnum << block) >> 2) + ymfm::detune_adjustment(ope.dt & 7, keycode)) & 0x1ffff;
+					ops.phaseStep[v] = (step * multiple) >> 1;
+					ops.totalLevel[v] = static_cast<uint16_t>((ope.tl & 0x7f) << 3);
+					uint32_t sustain = ope.sl & 0xf;
+					sustain |= (sustain + 1) & 0x10;
+					ops.sustain[v] = static_cast<uint16_t>(sustain << 5);
+					const uint32_t ksr = keycode >> ((ope.ks & 3) ^ 3);
+					ops.rate[ymfm::EG_ATTACK][v] = static_cast<uint8_t>(effectiveRate((ope.ar & 0x1f) * 2, ksr));
+					ops.rate[ymfm::EG_DECAY][v] = static_cast<uint8_t>(effectiveRate((ope.dr & 0x1f) * 2, ksr));
+					ops.rate[ymfm::EG_SUSTAIN][v] = static_cast<uint8_t>(effectiveRate((ope.sr & 0x1f) * 2, ksr));
+					ops.rate[ymfm::EG_RELEASE][v] = static_cast<uint8_t>(effectiveRate((ope.rr & 0xf) * 4 + 2, ksr));
+				}
+				const auto& algorithm = algorithms[voice.program.al & 7];
+				m_op2in[v] = algorithm.op2in;
+				m_op3in[v] = algorithm.op3in;
+				m_op4in[v] = algorithm.op4in;
+				m_outputs[v] = algorithm.outputs;
+				const uint8_t fb = voice.program.fb & 7;
+				m_feedbackShift[v] = static_cast<uint8_t>(10 - fb);
+				m_feedbackMask[v] = fb ? -1 : 0;
+			}
+
+			// キー状態の反映 (fm_operator::clock_keystate)
+			void clockKeystate() {
+				for (size_t v = 0; v < m_voices.size(); v++) {
+					auto& voice = m_voices[v];
+					if (voice.keyLive == voice.keyState) continue;
+					voice.keyState = voice.keyLive;
+					for (auto& ops : m_ops) {
+						auto& state = ops.state[v];
+						if (voice.keyState) {		// start_attack
+							if (state == ymfm::EG_ATTACK) continue;
+							state = ymfm::EG_ATTACK;
+							ops.phase[v] = 0;
+							if (ops.rate[ymfm::EG_ATTACK][v] >= 62) ops.attenuation[v] = 0;
+						} else {					// start_release
+							if (state >= ymfm::EG_RELEASE) continue;
+							state = ymfm::EG_RELEASE;
+						}
+					}
+				}
+			}
+
+			// エンベロープを進める (fm_operator::clock_envelope)
+			static void clockEnvelope(Operators& ops, size_t count, uint32_t envCounter) {
+				uint16_t* const attenuations = ops.attenuation.data();
+				uint8_t* const states = ops.state.data();
+				const uint16_t* const sustains = ops.sustain.data();
+				const uint8_t* const rates[] = { ops.rate[0].data(), ops.rate[1].data(), ops.rate[2].data(), ops.rate[3].data(), ops.rate[4].data() };
+				for (size_t v = 0; v < count; v++) {
+					uint32_t attenuation = attenuations[v];
+					uint32_t state = states[v];
+					if (state == ymfm::EG_ATTACK && attenuation == 0) state = ymfm::EG_DECAY;
+					if (state == ymfm::EG_DECAY && attenuation >= sustains[v]) state = ymfm::EG_SUSTAIN;
+					states[v] = static_cast<uint8_t>(state);
+
+					const uint32_t rate = rates[state][v];
+					const uint32_t rateShift = rate >> 2;
+					const uint32_t counter = envCounter << rateShift;
+					if (ymfm::bitfield(counter, 0, 11) != 0) continue;
+					const uint32_t increment = ymfm::attenuation_increment(rate, ymfm::bitfield(counter, (rateShift <= 11) ? 11 : rateShift, 3));
+					if (state == ymfm::EG_ATTACK) {
+						if (rate < 62) attenuation += (~attenuation * increment) >> 4;
+					} else {
+						attenuation += increment;
+						if (attenuation >= 0x400) attenuation = 0x3ff;
+					}
+					attenuations[v] = static_cast<uint16_t>(attenuation);
+				}
+			}
+
+			// オペレータの出力 (fm_operator::compute_volume  14bit符号付)
+			// ボイス毎のループをベクトル化できるよう、分岐の代わりにマスクで無音,符号を反映する
+			static int32_t computeVolume(const uint16_t* wave, const uint16_t* volume, uint32_t phase, uint32_t attenuation, uint32_t totalLevel) {
+				const uint32_t sin = wave[phase & 0x3ff];
+				const uint32_t env = (std::min<uint32_t>)(attenuation + totalLevel, 0x3ff) << 2;
+				const int32_t result = volume[(sin & 0x7fff) + env] & -static_cast<int32_t>(attenuation <= quietAttenuation);
+				const int32_t sign = -static_cast<int32_t>(sin >> 15);
+				return (result ^ sign) - sign;
+			}
+
+			// 全ボイスを1クロック進め、ボイス毎の出力を output[0～ボイス数-1] へ (fm_engine_base::clock + fm_channel::output_4op)
+			// ボイス毎のループをオペレータ単位で回し、ボイス間の依存の無いループにする
+			void clock(int32_t* output) {
+				const size_t count = m_voices.size();
+				if (m_keyChanged) {
+					clockKeystate();
+					m_keyChanged = false;
+				}
+				if (ymfm::bitfield(++m_envCounter, 0, 2) == 3) m_envCounter += 1;		// OPN のエンベロープは3クロックに1回
+
+				for (size_t v = 0; v < count; v++) {
+					m_feedback0[v] = m_feedback1[v];
+					m_feedback1[v] = m_feedbackIn[v];
+				}
+				const bool envelope = ymfm::bitfield(m_envCounter, 0, 2) == 0;
+				for (auto& ops : m_ops) {
+					if (envelope) clockEnvelope(ops, count, m_envCounter >> 2);
+					for (size_t v = 0; v < count; v++) ops.phase[v] += ops.phaseStep[v];
+				}
+
+				const uint16_t* wave = waveform().data();
+				const uint16_t* volume = volumes().data();
+				int16_t* const opout = m_opout.data();		// [opout の添字][ボイス]
+				const auto input = [opout, count](const std::vector<uint8_t>& index, size_t v) {		// 変調入力
+					return static_cast<int32_t>(opout[index[v] * count + v] >> 1);
+				};
+				const auto operate = [&](size_t op, auto f) {		// オペレータ毎にボイス全体を処理
+					const uint32_t* phase = m_ops[op].phase.data();
+					const uint16_t* attenuation = m_ops[op].attenuation.data();
+					const uint16_t* totalLevel = m_ops[op].totalLevel.data();
+					for (size_t v = 0; v < count; v++) {
+						f(v, [&](int32_t opmod) {
+							return computeVolume(wave, volume, (phase[v] >> 10) + opmod, attenuation[v], totalLevel[v]);
+						});
+					}
+				};
+				int16_t* const out1 = opout + count, * const out2 = opout + count * 2, * const out3 = opout + count * 3;
+				// op1 (自己フィードバック)
+				operate(0, [&](size_t v, auto compute) {
+					const int32_t opmod = ((m_feedback0[v] + m_feedback1[v]) >> m_feedbackShift[v]) & m_feedbackMask[v];
+					out1[v] = m_feedbackIn[v] = static_cast<int16_t>(compute(opmod));
+				});
+				// op2
+				operate(1, [&](size_t v, auto compute) {
+					out2[v] = static_cast<int16_t>(compute(input(m_op2in, v)));
+					opout[count * 5 + v] = out1[v] + out2[v];
+				});
+				// op3
+				operate(2, [&](size_t v, auto compute) {
+					out3[v] = static_cast<int16_t>(compute(input(m_op3in, v)));
+					opout[count * 6 + v] = out1[v] + out3[v];
+					opout[count * 7 + v] = out2[v] + out3[v];
+				});
+				// op4 と出力 (OPN は途中のクリップ無しの14bit、DAC(10.3浮動小数点)を経由した値)
+				// 14bitの4オペレータの和はクリップ範囲を超えないので、クリップは最後に1回だけ行う
+				operate(3, [&](size_t v, auto compute) {
+					const uint32_t outputs = m_outputs[v];
+					int32_t result = compute(input(m_op4in, v));
+					result += out1[v] & -static_cast<int32_t>(outputs & 1);
+					result += out2[v] & -static_cast<int32_t>((outputs >> 1) & 1);
+					result += out3[v] & -static_cast<int32_t>((outputs >> 2) & 1);
+					output[v] = ymfm::roundtrip_fp(std::clamp<int32_t>(result, -32768, 32767));
+				});
+
+				if (!m_keyonPending) return;
+				m_keyonPending = false;
+				for (auto& voice : m_voices) {
+					if (!voice.keyonPending) continue;
+					voice.keyonPending = false;
+					voice.keyLive = true;
+					m_keyChanged = true;
+				}
+			}
+
+			// 全キャリアが無音レベルまで減衰したか (OpnFmRegisterT::fmIsIdle と同じ)
+			bool isIdle(size_t v)const {
+				const auto& voice = m_voices[v];
+				if (voice.keyLive != voice.keyState || voice.keyonPending) return false;		// キーオンが未反映
+				const uint8_t carriers = m_outputs[v] | 0b1000;
+				for (uint8_t op = 0; op < 4; op++) {
+					if (!(carriers & (1u << op))) continue;
+					if (m_ops[op].state[v] == ymfm::EG_ATTACK || m_ops[op].attenuation[v] < quietAttenuation) return false;
+				}
+				return true;
+			}
+
+			// ボイスを削除 (最後のボイスを移動して詰める)
+			void removeVoice(size_t v) {
+				const size_t last = m_voices.size() - 1;
+				if (v != last) {
+					m_voices[v] = std::move(m_voices[last]);
+					forArrays([v, last](auto& a) { a[v] = a[last]; });
+				}
+				m_voices.pop_back();
+				forArrays([](auto& a) { a.pop_back(); });
+			}
+
+		public:
+			VoiceEngine(RendererT& renderer)
+				: m_renderer(renderer)
+			{}
+			VoiceEngine(const VoiceEngine&) = delete;
+			VoiceEngine& operator=(const VoiceEngine&) = delete;
+
+			// ノートオン (同一キーの発音は置き換える)
+			void noteOn(uint8_t key, const PresetKey& presetKey, const ChipWrapper2203::FmProgramReg& program, double pitch) {
+				auto it = std::find_if(m_voices.begin(), m_voices.end(), [key](const Voice& voice) { return voice.key == key; });
+				if (it == m_voices.end()) {		// 新しいボイスはリセット直後のチャンネルの状態から
+					it = m_voices.emplace(m_voices.end());
+					forArrays([](auto& a) { a.emplace_back(); });
+					for (auto& ops : m_ops) {
+						ops.attenuation.back() = 0x3ff;
+						ops.state.back() = ymfm::EG_RELEASE;
+					}
+				}
+				// キーオフ→キーオンの間にクロックが無いとキーオンとみなされない
+				// 同じ位置のノートオフ→ノートオンでは keyLive は既に落ちているので、反映済のキー状態(keyState)も見る
+				const bool retrigger = it->keyState || it->keyLive;
+				const bool keyState = it->keyState;
+				*it = Voice{ key, presetKey, (static_cast<T>(1.0) / 32767) * midi::volumeGainTable<T>[presetKey.velocity], program };
+				it->keyState = keyState;
+				m_pitch = pitch;
+				cache(std::distance(m_voices.begin(), it));
+				if (retrigger) {
+					it->keyonPending = true;
+					m_keyonPending = true;
+				} else {
+					it->keyLive = true;
+				}
+				m_keyChanged = true;
+			}
+
+			void noteOff(uint8_t key) {
+				for (auto& voice : m_voices) {
+					if (voice.key != key || voice.keyoff) continue;
+					voice.keyoff = true;
+					voice.keyLive = false;
+					voice.keyonPending = false;
+					m_keyChanged = true;
+				}
+			}
+
+			void setPitchBend(double pitch) {
+				m_pitch = pitch;
+				for (size_t v = 0; v < m_voices.size(); v++) cache(v);
+			}
+
+			// レンダリング(モノラル チップのサンプリングレート(masterClock / FmChip2203::clockDivider)のまま 結果配列がsize未満なら全ボイス完了)
+			// 出力サンプリングレートへの変換は呼び出し側(モジュールで1つの Resampler)で行う
+			std::vector<T> render(size_t size) {
+				std::vector<T> result(size);
+				size_t resultSize = 0;
+				for (size_t offset = 0; offset < size && !m_voices.empty();) {
+					const size_t clocks = (std::min)(size - offset, blockClocks);
+					const size_t count = m_voices.size();
+					m_opout.assign(8 * count, 0);
+					m_block.resize(clocks * count);
+					for (size_t i = 0; i < clocks; i++) clock(m_block.data() + i * count);
+
+					std::vector<size_t> finished;
+					for (size_t v = 0; v < count; v++) {
+						auto& voice = m_voices[v];
+						T* dst = result.data() + offset;
+						bool silent = false;
+						for (size_t i = 0; i < clocks; i++) {
+							const int32_t out = m_block[i * count + v];
+							if (out == 0) {
+								if (voice.keyoff && ++voice.silenceCount > 16) {	// 発音完了？
+									resultSize = (std::max)(resultSize, offset + i);
+									silent = true;
+									break;
+								}
+							} else {
+								voice.silenceCount = 0;
+								dst[i] += out * voice.amplitude;		// -1.0～1.0 へ変換(veloctiy込み)
+							}
+						}
+						if (!silent) resultSize = offset + clocks;
+						if (silent || isIdle(v)) finished.push_back(v);		// エンベロープが減衰しきっていれば発音完了
+					}
+					for (auto it = finished.rbegin(); it != finished.rend(); ++it) removeVoice(*it);
+					offset += clocks;
+				}
+				result.resize(resultSize);
+				return result;
+			}
+
+			bool empty()const {
+				return m_voices.empty();
+			}
+		};
+
+		std::unique_ptr<VoiceEngine> createVoiceEngine() {
+			return std::make_unique<VoiceEngine>(*this);
+		}
+
 	};
 
 
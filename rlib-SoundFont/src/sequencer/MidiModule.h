@@ -1,6 +1,8 @@
 ﻿#pragma once
 
+#include <array>
 #include <future>
+#include <memory>
 #include <typeindex>
 
 #include "../sequencer/MidiEvent.h"
@@ -31,6 +33,66 @@ namespace rlib::midi {
 	};
 
 
+	// 発音中ノート管理 (キー毎の発音数 + 発音順の連続配列)
+	template <typename Note> class NoteTable {
+	public:
+		struct Voice {
+			uint8_t					key;	// 0～127
+			std::shared_ptr<Note>	note;
+		};
+	private:
+		std::vector<Voice>			m_voices;			// 発音中リスト(発音順)
+		std::array<uint16_t, 128>	m_keyCount = {};	// キー毎の発音数
+	public:
+		// 追加 (同一キーの発音は残す)
+		void add(uint8_t key, std::shared_ptr<Note> note) {
+			key &= 0x7f;
+			m_voices.push_back(Voice{ key, std::move(note) });
+			m_keyCount[key]++;
+		}
+
+		// 追加 (同一キーの発音は破棄して置き換える)
+		void replace(uint8_t key, std::shared_ptr<Note> note) {
+			key &= 0x7f;
+			if (m_keyCount[key] > 0) {
+				eraseIf([key](const Voice& v) { return v.key == key; });
+			}
+			add(key, std::move(note));
+		}
+
+		// 指定キーの発音全てに f(Note&) を実施
+		template <typename F> void forKey(uint8_t key, F f) {
+			key &= 0x7f;
+			if (m_keyCount[key] == 0) return;
+			for (auto& v : m_voices) {
+				if (v.key == key) f(*v.note);
+			}
+		}
+
+		// 条件に合う発音を破棄(発音順は維持)
+		template <typename Pred> void eraseIf(Pred pred) {
+			std::erase_if(m_voices, [&](const Voice& v) {
+				if (!pred(v)) return false;
+				m_keyCount[v.key]--;
+				return true;
+			});
+		}
+
+		bool empty()const { return m_voices.empty(); }
+		size_t size()const { return m_voices.size(); }
+		auto begin() { return m_voices.begin(); }
+		auto end() { return m_voices.end(); }
+		auto begin()const { return m_voices.begin(); }
+		auto end()const { return m_voices.end(); }
+	};
+
+	// チャンネル配列生成 (Channel(uint8_t) コンストラクタでチャンネル番号 0～15 を与える)
+	template <typename Channel> static std::array<Channel, 16> makeChannels() {
+		return[]<size_t... I>(std::index_sequence<I...>) {
+			return std::array<Channel, 16>{ Channel(static_cast<uint8_t>(I))... };
+		}(std::make_index_sequence<16>());
+	}
+
 	// volume用 振幅値(0.0～1.0)テーブル
 	template <typename T> static const std::array<T, 128> volumeGainTable = [] {				// volume用 振幅値(0.0～1.0)テーブル
 		std::array<T, 128> table = {};
@@ -83,55 +145,67 @@ namespace rlib::midi {
 		// エンベロープ係数(0.0～1.0)取得 (キーオフ前)
 		std::vector<T> getGains(size_t position, size_t size)const {
 			std::vector<T> result(size);	// 今回出力するサンプル数
+			getGains(position, result.data(), result.size());
+			return result;
+		}
+
+		// エンベロープ係数(0.0～1.0)取得 (キーオフ前) 呼び出し側のバッファへ出力
+		void getGains(size_t position, T* result, size_t size)const {
 			size_t i = 0;
 
 			// delayVolEnv (アタックが始まるまで)
 			if (position + i < m_params.delayVolEnv) {
 				size_t diff = m_params.delayVolEnv - (position + i);
-				i += diff;
-				if (i >= result.size()) return result;
+				const size_t max = (std::min)(size, i + diff);
+				for (; i < max; i++) result[i] = 0.0;
+				if (i >= size) return;
 			}
 
 			// AttackRate
 			if (position + i < m_params.delayVolEnv + m_params.attackVolEnv) {
 				size_t pos = (position + i) - m_params.delayVolEnv;					// AttackRate開始からの位置
-				const size_t max = (std::min)(result.size(), i + (m_params.attackVolEnv - pos));
+				const size_t max = (std::min)(size, i + (m_params.attackVolEnv - pos));
 				for (; i < max; i++, pos++) result[i] = m_divAttack * (pos + 1);
-				if (i >= result.size()) return result;
+				if (i >= size) return;
 			}
 
 			// Hold (アタックが終わってからディケイが始まるまで)
 			const size_t beginHold = m_params.delayVolEnv + m_params.attackVolEnv;	// Hold開始位置
 			if (position + i < beginHold + m_params.holdVolEnv) {					// エンベロープのホールド時間(アタックが終わってからディケイが始まるまで)
 				size_t pos = (position + i) - beginHold;							// Hold開始からの位置
-				const size_t max = (std::min)(result.size(), i + (m_params.holdVolEnv - pos));
+				const size_t max = (std::min)(size, i + (m_params.holdVolEnv - pos));
 				for (; i < max; i++) result[i] = 1.0;
-				if (i >= result.size()) return result;
+				if (i >= size) return;
 			}
 
 			// DecayRate
 			const size_t beginDecay = beginHold + m_params.holdVolEnv;				// DecayRate開始位置
 			if (position + i < beginDecay + m_params.decayVolEnv) {
 				size_t pos = (position + i) - beginDecay;							// DecayRate開始からの位置
-				const size_t max = (std::min)(result.size(), i + (m_params.decayVolEnv - pos));
+				const size_t max = (std::min)(size, i + (m_params.decayVolEnv - pos));
 				for (; i < max; i++, pos++) {
 					const size_t remain = m_params.decayVolEnv - pos;				// ディケイ完了までの時間(サンプル数)
 					result[i] = m_params.sustainVolEnv + (m_divSustainDecay * remain);
 				}
-				if (i >= result.size()) return result;
+				if (i >= size) return;
 			}
 
 			// sustainVolEnv
-			for (; i < result.size(); i++) result[i] = m_params.sustainVolEnv;
-
-			return result;
+			for (; i < size; i++) result[i] = m_params.sustainVolEnv;
 		}
 
 		// エンベロープ係数(0.0～1.0)取得 (キーオフ後)
 		std::vector<T> getGainsReleaseRate(size_t position, size_t size)const {
+			std::vector<T> result(size);
+			result.resize(getGainsReleaseRate(position, result.data(), result.size()));
+			return result;
+		}
+
+		// エンベロープ係数(0.0～1.0)取得 (キーオフ後) 呼び出し側のバッファへ出力。戻り値は出力数(size未満なら終了の意味)
+		size_t getGainsReleaseRate(size_t position, T* result, size_t size)const {
 			const size_t remain = m_params.releaseVolEnv - position;	// 終了(無音)までの残りサンプル数
-			std::vector<T> result(std::min(size, remain));				// 今回出力するサンプル数
-			for (size_t i = 0; i < result.size(); i++) {
+			const size_t count = std::min(size, remain);				// 今回出力するサンプル数
+			for (size_t i = 0; i < count; i++) {
 				const auto linear = m_divRelease * (remain - i);		// キーオフから終了(無音)までの位置を 1.0～0.0 で表した値
 #if 0
 				// 0～1 の入力値を曲線で返す exponent:調整値 1.0=線形 1未満:立ち上がりが速い 1以上:遅い
@@ -151,7 +225,7 @@ namespace rlib::midi {
 #endif
 				result[i] = curve(linear, 8);				// 8:さじ加減
 			}
-			return result;
+			return count;
 		}
 
 	};
@@ -22,12 +22,22 @@ namespace rlib::fm::psg {
 	// だが、ym2203_ssg はトーン(矩形波)のみのため音色(プログラム)の概念が無く、
 	// プログラムチェンジ/バンクセレクトは受信のみ行い実際の音には影響しない。
 	template <typename T = double> class MidiModuleT : public midi::MidiModuleBase<T> {
+	public:
+		using Oscillator = typename RendererT<T>::Oscillator;
+		// 名前から波形の生成方法を取得 ("chip" | "analytic")
+		static Oscillator toOscillator(std::string_view name) {
+			if (name == "chip") return Oscillator::chip;
+			if (name == "analytic") return Oscillator::analytic;
+			throw std::runtime_error("unknown psg oscillator.");
+		}
+	private:
 		using Bit14 = midi::utility::Bit14;
 
 		struct Preset {
 			std::string							name;
 			typename RendererT<T>::Envelope		envelope;
 			typename RendererT<T>::Mixer		mixer;
+			std::shared_ptr<typename RendererT<T>::Program>	program = {};	// envelope,mixer から作成した Program のキャッシュ(初回のノートオン時に作成)
 		};
 
 		std::map<uint16_t, std::map< uint8_t, typename MidiModuleT<T>::Preset>> m_presets = {
@@ -92,72 +102,62 @@ namespace rlib::fm::psg {
 			std::optional<Bit14>	m_rpn;
 			Bit14					m_dataEntry;
 
-			std::map<uint8_t, std::shared_ptr<typename RendererT<T>::Note>>	m_notes;
+			midi::NoteTable<typename RendererT<T>::Note>	m_notes;		// 発音中のノート
+			std::vector<T>									m_mono;			// ノートのミックス先
+			typename RendererT<T>::WorkBuffer				m_work;			// ノートのレンダリング用の作業領域
 
 			Channel(uint8_t channel)
 				:m_channel(channel)
 			{
 			}
 
-			struct Less {
-				typedef void is_transparent;
-				bool operator()(const Channel& a, const Channel& b)				const { return a.m_channel < b.m_channel; }
-				bool operator()(const decltype(m_channel) a, const Channel& b)	const { return a < b.m_channel; }
-				bool operator()(const Channel& a, const decltype(m_channel) b)	const { return a.m_channel < b; }
-			};
-
 		};
-		std::set<Channel, typename Channel::Less>	m_channels;
+		std::array<Channel, 16>	m_channels = midi::makeChannels<Channel>();
 		uint16_t	m_masterVolume = 16383;	// マスターボリューム 0-～16383 (14bit)
 
-		Channel& ensureChannel(uint8_t channel) {
-			if (auto i = m_channels.find(channel); i != m_channels.end()) {
-				return const_cast<Channel&>(*i);
-			}
-			auto i = m_channels.emplace(channel);
-			return const_cast<Channel&>(*i.first);
+		Channel& getChannel(uint8_t channel) {
+			return m_channels[channel & 0xf];
 		}
 
 		void eventNoteOn(const midi::Event& event) {
 			const midi::EventNoteOn &ev = static_cast<decltype(ev)>(event);
 			if (ev.velocity == 0) return eventNoteOff(event);	// noteoff?
 
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 
 			const auto itBank = m_presets.find(channel.m_bank);
 			if (itBank == m_presets.end()) return;
 			const auto it = itBank->second.find(channel.m_programNo);
 			if (it == itBank->second.end()) return;
-			const auto& program = it->second;
+			auto& preset = it->second;
+			if (!preset.program) {
+				preset.program = m_renderer.createProgram(preset.envelope, preset.mixer);
+			}
 
 			typename RendererT<T>::PresetKey key;
 			key.note = ev.note + channel.m_coarseTune;
 			key.velocity = ev.velocity;
 			key.fineTune = channel.m_fineTune;
 
-			auto spProgram = m_renderer.createProgram(program.envelope, program.mixer);
-
-			const auto spNote = m_renderer.createNote(key, spProgram, channel.m_pitch.get().result);
-			channel.m_notes[ev.note] = spNote;
+			const auto spNote = m_renderer.createNote(key, preset.program, channel.m_pitch.get().result);
+			channel.m_notes.replace(ev.note, spNote);
 
 		}
 
 		void eventNoteOff(const midi::Event& event) {
 			const midi::EventNote& ev = static_cast<decltype(ev)>(event);			// NoteOn から来ることもあるので midi::EventNote に
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 
-			if (auto i = channel.m_notes.find(ev.note); i != channel.m_notes.end()) {
-				auto sp = i->second;
-				if (!sp) throw std::runtime_error("eventNoteOff not note.");			// failsafe
-				sp->setKeyoff();
-			}
+			channel.m_notes.forKey(ev.note, [](auto& note) {
+				note.setKeyoff();
+			});
 
 		}
 
 		void eventControlChange(const midi::Event& event) {
 			using namespace midi;
 			const EventControlChange& ev = static_cast<decltype(ev)>(event);
-			const auto channel = [&]()->Channel& {return ensureChannel(ev.channel); };
+			const auto channel = [&]()->Channel& {return getChannel(ev.channel); };
 
 			const auto procDataEntry = [&](auto& ch) {
 				if (ch.m_rpn) {
@@ -253,7 +253,7 @@ namespace rlib::fm::psg {
 		void eventProgramChange(const midi::Event& event) {
 			using namespace midi;
 			const EventProgramChange& ev = static_cast<decltype(ev)>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			channel.m_programNo = ev.programNo;
 			channel.m_bank = static_cast<int16_t>(channel.m_backselect.msb) * 0x80 + channel.m_backselect.lsb;
 		}
@@ -261,16 +261,14 @@ namespace rlib::fm::psg {
 		void eventPitchBend(const midi::Event& event) {
 			using namespace midi;
 			const auto& ev = static_cast<const EventPitchBend&>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			const auto& before = channel.m_pitch.get();
 			channel.m_pitch.set(ev.pitchBend, before.pitchBendRange);
 
 			// 発音中のNote に設定
 			const auto pitch = channel.m_pitch.get().result;
-			for (auto note : channel.m_notes) {
-				if (note.second) {		// failsafe
-					note.second->setPitchBend(pitch);
-				}
+			for (auto& voice : channel.m_notes) {
+				voice.note->setPitchBend(pitch);
 			}
 		}
 
@@ -294,7 +292,7 @@ namespace rlib::fm::psg {
 				u.lsb = ev.data[5];
 				u.msb = ev.data[6];
 				m_masterVolume = u.value;
-				for (auto& ch : m_channels) const_cast<Channel&>(ch).m_gain = std::nullopt;	// 全チャンネル要再計算
+				for (auto& ch : m_channels) ch.m_gain = std::nullopt;	// 全チャンネル要再計算
 				return;
 			}
 		}
@@ -339,6 +337,7 @@ namespace rlib::fm::psg {
 						const auto noise = valInt();
 						pg.mixer.noise = static_cast<uint8_t>(std::clamp<std::intmax_t>(noise, 0, 31));
 						pg.mixer.tone = valInt() != 0;
+						pg.program.reset();		// 再作成させる
 
 					}
 
@@ -378,24 +377,18 @@ namespace rlib::fm::psg {
 #endif
 			std::vector<std::future<std::vector<midi::StereoSample<T>>>> futureChannels;
 			for (auto& channel : m_channels) {
-				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel = const_cast<Channel&>(channel), size, asyncLaunch] {
-
-					std::vector<T> resultMono;
-					for (auto it = channel.m_notes.begin(); it != channel.m_notes.end();) {
-						auto sp = it->second;
-						if (!sp) throw std::runtime_error("not released note.");	// failsafe
-						auto samples = sp->render(size);
-						if (samples.size() < size)	it = channel.m_notes.erase(it);		// 終わっていればmapから破棄
-						else						it++;
-						if (resultMono.empty()) {		// 最初なら代入(加算不要)
-							resultMono = std::move(samples);
-						} else {
-							resultMono.resize((std::max)(resultMono.size(), samples.size()));
-							for (size_t i = 0; i < samples.size(); i++) {
-								resultMono[i] += samples[i];
-							}
-						}
+				if (channel.m_notes.empty()) continue;		// 発音中のノートが無いチャンネルは対象外
+				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel, size, asyncLaunch] {
+
+					auto& mono = channel.m_mono;
+					mono.assign(size, 0);
+					size_t length = 0;
+					for (auto& voice : channel.m_notes) {
+						length = (std::max)(length, voice.note->render(mono.data(), size, channel.m_work));
 					}
+					channel.m_notes.eraseIf([](const auto& voice) {
+						return voice.note->isFinished();		// 終わっていれば破棄
+					});
 
 					// 音量処理(channel.m_gain算出)
 					if (!channel.m_gain) {
@@ -403,10 +396,10 @@ namespace rlib::fm::psg {
 						const auto& pan = midi::panGainTable<T>[channel.m_pan];
 						channel.m_gain = { n * pan.first, n * pan.second };
 					}
-					std::vector<midi::StereoSample<T>> result(resultMono.size());
+					std::vector<midi::StereoSample<T>> result(length);
 					for (size_t i = 0; i < result.size(); i++) {
-						result[i].l = resultMono[i] * channel.m_gain->first;
-						result[i].r = resultMono[i] * channel.m_gain->second;
+						result[i].l = mono[i] * channel.m_gain->first;
+						result[i].r = mono[i] * channel.m_gain->second;
 					}
 
 					return result;
@@ -439,8 +432,10 @@ namespace rlib::fm::psg {
 			return true;
 		}
 
-		MidiModuleT(uint32_t sampleRate)
-			: m_renderer(sampleRate)
+		// fidelity:チップの忠実度 (下げるとレンダリングが速くなる)
+		// oscillator:波形の生成方法 (Oscillator::analytic はチップを使わないため fidelity は無関係で、最も速い)
+		MidiModuleT(uint32_t sampleRate, Fidelity fidelity = Fidelity::max, Oscillator oscillator = Oscillator::chip)
+			: m_renderer(sampleRate, fidelity, oscillator)
 			, m_sampleRate(sampleRate)
 		{
 		}
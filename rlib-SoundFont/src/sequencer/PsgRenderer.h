@@ -1,7 +1,9 @@
 ﻿#pragma once
 
 #include <algorithm>
+#include <cmath>
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include "../ymfm/ymfm_opn.h"
@@ -9,6 +11,94 @@
 
 namespace rlib::fm::psg {
 
+	// PSG(SSG)の1チャンネル分の波形を、チップを使わずに出力サンプリングレートで直接生成する
+	// トーン(矩形波)とノイズ(17bit LFSR)の変化点を SSG のクロック(masterClock/16)単位の時刻で求めて ymfm と同じ波形を作り、
+	// 変化点は polyBLEP で帯域制限する(変化点の前後1サンプルを補正するため、出力は1サンプル遅れる)
+	class AnalyticOscillator {
+		static constexpr double tickRate = ChipWrapper2203::masterClock / 16.0;		// SSG のクロック(Hz)
+
+		const double	m_ticksPerSample;	// 出力1サンプルあたりのクロック数
+		const bool		m_toneEnable;
+		const bool		m_noiseEnable;
+		uint32_t		m_tonePeriod;		// トーンの反転間隔(クロック数) = トーン周期レジスタ値
+		const uint32_t	m_noisePeriod;		// LFSR のシフト間隔(クロック数) = ノイズ周波数レジスタ値 × 2
+
+		double		m_time = 0;			// レンダリング済の時刻(クロック数)
+		double		m_toneNext;			// 次にトーンが反転する時刻
+		double		m_noiseNext;		// 次に LFSR がシフトする時刻
+		uint8_t		m_toneState = 0;
+		uint32_t	m_noiseState = 1;
+		double		m_level;			// 現在の出力(0 or 1)
+		double		m_pending = 0;		// 次の出力に加える補正値(polyBLEP の変化点以降の分)
+
+		// ymfm と同じく、トーンとノイズの AND (無効なものは常に1)
+		double level()const {
+			return ((!m_toneEnable || m_toneState) && (!m_noiseEnable || (m_noiseState & 1))) ? 1.0 : 0.0;
+		}
+
+	public:
+		// noise:ノイズ周波数 0:OFF, 1～31:ON
+		AnalyticOscillator(uint32_t sampleRate, uint8_t noise, bool tone, uint32_t tonePeriod)
+			: m_ticksPerSample(tickRate / sampleRate)
+			, m_toneEnable(tone)
+			, m_noiseEnable(noise != 0)
+			, m_tonePeriod(tonePeriod)
+			, m_noisePeriod(2 * (std::max)(noise & 0x1f, 1))
+			, m_toneNext(tonePeriod)
+			, m_noiseNext(m_noisePeriod)
+			, m_level(level())
+		{
+		}
+
+		// トーン周期を変更 (ymfm と同様に、直前の反転からのクロック数が新しい周期に達したら反転する)
+		void setTonePeriod(uint32_t tonePeriod) {
+			const double last = m_toneNext - m_tonePeriod;
+			m_tonePeriod = tonePeriod;
+			m_toneNext = (std::max)(last + tonePeriod, std::floor(m_time) + 1);
+		}
+
+		// 出力(0.0～1.0 付近)を size 個生成
+		template <typename T> void render(T* output, size_t size) {
+			const double step = m_ticksPerSample;
+			for (size_t n = 0; n < size; n++) {
+				const double begin = m_time;
+				const double end = begin + step;
+				double result = m_level + m_pending;		// 1サンプル前の時刻の出力
+				double pending = 0;
+				for (;;) {
+					const double t = (std::min)(m_toneNext, m_noiseNext);
+					if (t > end) break;
+					if (m_toneNext == t) {
+						m_toneState ^= 1;
+						m_toneNext += m_tonePeriod;
+					}
+					if (m_noiseNext == t) {
+						m_noiseState ^= ((m_noiseState ^ (m_noiseState >> 3)) & 1) << 17;
+						m_noiseState >>= 1;
+						m_noiseNext += m_noisePeriod;
+					}
+					const double next = level();
+					if (next != m_level) {
+						const double height = next - m_level;
+						const double d = (t - begin) / step;		// サンプル間での変化点の位置(0.0～1.0)
+						result += height * (1 - d) * (1 - d) / 2;
+						pending -= height * d * d / 2;
+						m_level = next;
+					}
+				}
+				output[n] = static_cast<T>(result);
+				m_pending = pending;
+				m_time = end;
+			}
+
+			// 時刻の原点を移して精度の低下を防ぐ
+			const double base = std::floor(m_time);
+			m_time -= base;
+			m_toneNext -= base;
+			m_noiseNext -= base;
+		}
+	};
+
 	// PSG(SSG)音源のレンダラー。
 	template <typename T = double> class RendererT {
 	public:
@@ -31,11 +121,22 @@ namespace rlib::fm::psg {
 			double		fineTune = 0.0;
 		};
 
+		// 波形の生成方法
+		enum class Oscillator {
+			chip,			// ノート毎に ym2203 を1つ使う(SSG部のチャンネル0のみ使用)。基準となる実装
+			analytic,		// AnalyticOscillator で出力サンプリングレートのまま直接生成する
+		};
+
 	public:
 		const uint32_t	m_sampleRate;
+		const Fidelity	m_fidelity;		// チップの忠実度
+		const Oscillator	m_oscillator;
+		static constexpr size_t blockClocks = 1024;		// チップをまとめてクロックする単位
 
-		RendererT(uint32_t sampleRate)
+		RendererT(uint32_t sampleRate, Fidelity fidelity = Fidelity::max, Oscillator oscillator = Oscillator::chip)
 			:m_sampleRate(sampleRate)
+			, m_fidelity(fidelity)
+			, m_oscillator(oscillator)
 		{
 		}
 		RendererT(const RendererT&) = delete;
@@ -46,13 +147,30 @@ namespace rlib::fm::psg {
 			const Mixer				m_mixer;
 		};
 
+		// Note::render の作業領域 (ノート間で使い回してレンダリング毎の確保を避ける)
+		struct WorkBuffer {
+			std::vector<T>	env;		// エンベロープ値
+			std::vector<T>	wave;		// PSG出力
+		};
+
 		class Note {
 			friend class RendererT;
 		public:
 			RendererT& m_renderer;
 			const PresetKey m_presetKey;
 		private:
-			ChipWrapper2203	m_chip;
+			struct Chip {		// Oscillator::chip
+				ChipWrapper2203	chip;
+				ClockSchedule	schedule;
+				std::vector<typename ChipWrapper2203::ChipType::output_data>	buffer;		// ブロック単位のチップ出力
+				Chip(Fidelity fidelity, uint32_t sampleRate)
+					: chip(fidelity)
+					, schedule(ChipWrapper2203::masterClock, ChipWrapper2203::masterClock / chip.m_chip.sample_rate(ChipWrapper2203::masterClock), sampleRate)
+				{
+				}
+			};
+			std::unique_ptr<Chip>				m_chip;
+			std::optional<AnalyticOscillator>	m_analytic;		// Oscillator::analytic
 
 			size_t	m_position = 0;			// 位置(レンダリング済の出力サンプル数)
 			struct Keyoff {
@@ -60,9 +178,9 @@ namespace rlib::fm::psg {
 				T		amplitude;			// キーオフされたときの音量(0.0～1.0)
 			};
 			std::optional<Keyoff>	m_keyoff;		// キーオフ
+			bool					m_finished = false;		// 発音完了
 
 			const T		m_amplitude;			// PSG出力値からT型へ変換する係数(velocity込み)
-			uintmax_t	m_clockCount = 0;		// 実施済クロック数
 			size_t		m_silenceCount = 0;
 			std::shared_ptr<Program> m_program;
 		private:
@@ -74,32 +192,45 @@ namespace rlib::fm::psg {
 				, m_amplitude(static_cast<T>(1.0) / (PsgRangeMax / 2) * GainAdjustment * midi::volumeGainTable<T>[presetKey.velocity] )
 				, m_program(program)
 			{
-				m_chip.psgSetPitch(presetKey.note, presetKey.fineTune + pitch);
-				if (program->m_mixer.noise != 0) {
-					m_chip.psgSetNoise(program->m_mixer.noise);
+				const auto& mixer = program->m_mixer;
+				if (renderer.m_oscillator == Oscillator::analytic) {
+					m_analytic.emplace(renderer.m_sampleRate, mixer.noise, mixer.tone, ChipWrapper2203::psgPeriod(presetKey.note, presetKey.fineTune + pitch));
+					return;
 				}
-				m_chip.psgSetLevel(15);
-				m_chip.psgSetMixer(program->m_mixer.noise != 0 ? 0b110 : 0b111, program->m_mixer.tone ? 0b110 : 0b111);	// ch0(A)のみ使用 0=enable,1=disable
+				m_chip = std::make_unique<Chip>(renderer.m_fidelity, renderer.m_sampleRate);
+				auto& chip = m_chip->chip;
+				chip.psgSetPitch(presetKey.note, presetKey.fineTune + pitch);
+				if (mixer.noise != 0) {
+					chip.psgSetNoise(mixer.noise);
+				}
+				chip.psgSetLevel(15);
+				chip.psgSetMixer(mixer.noise != 0 ? 0b110 : 0b111, mixer.tone ? 0b110 : 0b111);	// ch0(A)のみ使用 0=enable,1=disable
 			}
 
-			std::vector<int32_t> renderPsg(size_t size) {
-				std::vector<int32_t> result(size);
-				auto& chip = m_chip.m_chip;
-				const auto sr = chip.sample_rate(ChipWrapper2203::masterClock);	// 1秒あたりのクロック数		3,993,600/4 = 998,400
-				const T n = static_cast<T>(m_renderer.m_sampleRate) / sr;		// 1クロックあたりのサンプル数	44,100/998,400 = 0.04417
-				uintmax_t before = static_cast<uintmax_t>(m_clockCount * n);	// 読み出し済の位置(サンプルあたり)
+			// PSG出力(-PsgRangeMax/2～PsgRangeMax/2)を result へ size 個生成
+			// チップはブロック単位でまとめて生成し、出力サンプル毎に間引く
+			void renderPsg(T* result, size_t size) {
+				if (m_analytic) {
+					m_analytic->render(result, size);
+					for (size_t n = 0; n < size; n++) {
+						result[n] = result[n] * PsgRangeMax - PsgRangeMax / 2;
+					}
+					m_position += size;
+					return;
+				}
+				auto& chip = m_chip->chip.m_chip;
+				auto& schedule = m_chip->schedule;
+				auto& buffer = m_chip->buffer;
 				for (size_t outCount = 0; outCount < size; ) {
-					typename decltype(m_chip)::ChipType::output_data output;
-					chip.generate(&output, 1);
-					const uintmax_t current = static_cast<uintmax_t>((++m_clockCount) * n);	// 読み出し済の位置(サンプルあたり)
-					if (before != current) {										// 出力タイミング？
-						const auto sample = output.data[1];	// PSG
-						result[outCount++] = sample - PsgRangeMax / 2;
-						before = current;
+					const auto block = schedule.next(size - outCount, blockClocks);
+					buffer.resize(block.clocks);
+					chip.generate(buffer.data(), static_cast<uint32_t>(block.clocks));
+					for (const auto index : schedule.indexes()) {
+						const auto sample = buffer[index].data[1];	// PSG
+						result[outCount++] = static_cast<T>(sample - PsgRangeMax / 2);
 					}
 				}
 				m_position += size;
-				return result;
 			}
 
 		public:
@@ -108,27 +239,37 @@ namespace rlib::fm::psg {
 			Note& operator=(const Note&) = delete;
 
 			void setPitchBend(double pitch) {
-				m_chip.psgSetPitch(m_presetKey.note, m_presetKey.fineTune + pitch);
+				if (m_analytic) {
+					m_analytic->setTonePeriod(ChipWrapper2203::psgPeriod(m_presetKey.note, m_presetKey.fineTune + pitch));
+					return;
+				}
+				m_chip->chip.psgSetPitch(m_presetKey.note, m_presetKey.fineTune + pitch);
 			}
 
-			//// レンダリング（結果配列がsize未満なら完了）旧愚直コード
-			std::vector<T> render(size_t size) {
+			// レンダリング (output へ size 個まで加算。戻り値は出力サンプル数で、size未満なら完了)
+			// work は呼び出し側で使い回す作業領域
+			size_t render(T* output, size_t size, WorkBuffer& work) {
+				if (work.env.size() < size) work.env.resize(size);
+				if (work.wave.size() < size) work.wave.resize(size);
+				T* const env = work.env.data();		// エンベロープ値(0.0～1.0)
+				T* const wave = work.wave.data();
 
-				T				same;		// 全体に一律に掛ける値(0.0～1.0)ス
-				std::vector<T>	env;		// エンベロープ値(0.0～1.0) 結果兼
+				T		same;		// 全体に一律に掛ける値(0.0～1.0)
+				size_t	count = size;
 				if (m_keyoff) {
-					env = m_program->m_envelope.getGainsReleaseRate(m_position - m_keyoff->position, size);
+					count = m_program->m_envelope.getGainsReleaseRate(m_position - m_keyoff->position, env, size);
 					same = m_amplitude * m_keyoff->amplitude;
 				} else {
-					env = m_program->m_envelope.getGains(m_position, size);
+					m_program->m_envelope.getGains(m_position, env, size);
 					same = m_amplitude;
 				}
 
-				const auto samples = renderPsg(env.size());
-				for (size_t n = 0; n < samples.size(); n++) {
-					env[n] *= samples[n] * same;
+				renderPsg(wave, count);
+				for (size_t n = 0; n < count; n++) {
+					output[n] += env[n] * (wave[n] * same);
 				}
-				return env;
+				if (count < size) m_finished = true;	// size未満なら発音完了
+				return count;
 			}
 
 			// レンダリング(波形データ出力（結果配列がsize未満なら完了）
@@ -153,12 +294,15 @@ namespace rlib::fm::psg {
 
 			void setKeyoff() {
 				if (m_keyoff) return;		// 既にkeyoff済みなら無視する
-				const auto gains = m_program->m_envelope.getGains(m_position, 1);	// 現在のエンベロープ値
 				Keyoff k;
 				k.position = m_position;
-				k.amplitude = gains[0];
+				m_program->m_envelope.getGains(m_position, &k.amplitude, 1);	// 現在のエンベロープ値
 				m_keyoff = k;
 			}
+
+			bool isFinished()const {
+				return m_finished;
+			}
 		};
 
 		std::shared_ptr<Program> createProgram(const Envelope& envelope, const Mixer& mixer) {
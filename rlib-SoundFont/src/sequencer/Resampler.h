@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "MidiModule.h"
+
+namespace rlib::midi {
+
+	// サンプリングレート変換 (窓関数付き sinc のポリフェーズ FIR)
+	// 任意の変換比に対応するため、位相テーブル(phaseCount 分割)の隣接する係数を線形補間して用いる
+	// 入力は先読みするので遅延は無い(出力サンプル J は入力の時刻 J × 変換比 の位置)
+	template <typename T = double> class Resampler {
+		static constexpr size_t tapCount = 32;			// 1出力あたりの入力サンプル数
+		static constexpr size_t phaseCount = 256;		// 入力1サンプル間の位相の分割数
+		static constexpr size_t center = tapCount / 2 - 1;
+
+		const uintmax_t		m_step;			// 出力1サンプルあたりの入力サンプル数 = m_step / m_divider
+		const uintmax_t		m_divider;
+		std::vector<T>		m_table;		// 係数 [phaseCount + 1][tapCount]
+		std::vector<T>		m_left;			// 入力バッファ (m_position 以降が未使用)
+		std::vector<T>		m_right;
+		size_t				m_position = 0;		// 次の出力に用いる先頭の入力位置
+		uintmax_t			m_fraction = 0;		// 次の出力の位置の小数部 (単位:1/m_divider)
+
+		// Kaiser窓 (beta:阻止域減衰量の調整値)
+		static double kaiser(double x, double beta) {
+			if (std::abs(x) > 1) return 0;
+			const auto bessel = [](double v) {		// 第1種変形ベッセル関数(0次)
+				double sum = 1, term = 1;
+				for (int k = 1; k < 32; k++) {
+					term *= (v / (2 * k)) * (v / (2 * k));
+					sum += term;
+				}
+				return sum;
+			};
+			return bessel(beta * std::sqrt(1 - x * x)) / bessel(beta);
+		}
+
+	public:
+		// 入力のサンプリングレート = inputRate / inputDivider
+		Resampler(uintmax_t inputRate, uintmax_t inputDivider, uint32_t outputRate)
+			: m_step(inputRate)
+			, m_divider(inputDivider * outputRate)
+			, m_table((phaseCount + 1) * tapCount)
+		{
+			constexpr double pi = 3.14159265358979323846;
+			constexpr double beta = 7.0;
+			const double cutoff = 0.5 * (std::min)(1.0, static_cast<double>(m_divider) / m_step);	// 遮断周波数(入力1サンプルあたりの周期数) 出力のナイキスト周波数まで
+			for (size_t phase = 0; phase <= phaseCount; phase++) {
+				T* coefs = &m_table[phase * tapCount];
+				double sum = 0;
+				std::vector<double> h(tapCount);
+				for (size_t i = 0; i < tapCount; i++) {
+					const double x = static_cast<double>(i) - center - static_cast<double>(phase) / phaseCount;	// 出力位置からの距離(入力サンプル単位)
+					const double sinc = x == 0 ? 1.0 : std::sin(2 * pi * cutoff * x) / (2 * pi * cutoff * x);
+					h[i] = sinc * kaiser(x / (tapCount / 2), beta);
+					sum += h[i];
+				}
+				for (size_t i = 0; i < tapCount; i++) {
+					coefs[i] = static_cast<T>(h[i] / sum);		// 直流の利得を 1.0 に
+				}
+			}
+			reset();
+		}
+
+		// 入力の履歴を破棄
+		void reset() {
+			m_left.assign(center, 0);		// 出力サンプル 0 が入力サンプル 0 の位置になるよう、先頭に center 個の無音
+			m_right.assign(center, 0);
+			m_position = 0;
+			m_fraction = 0;
+		}
+
+		// outputSize 個の出力に必要な入力サンプル数
+		size_t getInputSize(size_t outputSize)const {
+			if (outputSize == 0) return 0;
+			const size_t last = m_position + static_cast<size_t>((m_fraction + (outputSize - 1) * m_step) / m_divider);	// 最後の出力に用いる先頭の入力位置
+			const size_t need = last + tapCount;
+			return need > m_left.size() ? need - m_left.size() : 0;
+		}
+
+		// input(getInputSize(outputSize) 個) を変換して output へ outputSize 個を出力
+		void process(const StereoSample<T>* input, StereoSample<T>* output, size_t outputSize) {
+			const size_t inputSize = getInputSize(outputSize);
+			const size_t offset = m_left.size();
+			m_left.resize(offset + inputSize);
+			m_right.resize(offset + inputSize);
+			for (size_t i = 0; i < inputSize; i++) {
+				m_left[offset + i] = input[i].l;
+				m_right[offset + i] = input[i].r;
+			}
+
+			std::array<T, tapCount> coefs;
+			for (size_t n = 0; n < outputSize; n++) {
+				// 位相の係数を線形補間
+				const uintmax_t scaled = m_fraction * phaseCount;
+				const size_t phase = static_cast<size_t>(scaled / m_divider);
+				const T weight = static_cast<T>(scaled % m_divider) / m_divider;
+				const T* a = &m_table[phase * tapCount];
+				const T* b = a + tapCount;
+				for (size_t i = 0; i < tapCount; i++) {
+					coefs[i] = a[i] + (b[i] - a[i]) * weight;
+				}
+
+				const T* l = &m_left[m_position];
+				const T* r = &m_right[m_position];
+				T sumL = 0, sumR = 0;
+				for (size_t i = 0; i < tapCount; i++) {
+					sumL += l[i] * coefs[i];
+					sumR += r[i] * coefs[i];
+				}
+				output[n].l = sumL;
+				output[n].r = sumR;
+
+				m_fraction += m_step;
+				m_position += static_cast<size_t>(m_fraction / m_divider);
+				m_fraction %= m_divider;
+			}
+
+			// 使用済の入力を破棄
+			m_left.erase(m_left.begin(), m_left.begin() + m_position);
+			m_right.erase(m_right.begin(), m_right.begin() + m_position);
+			m_position = 0;
+		}
+	};
+
+}
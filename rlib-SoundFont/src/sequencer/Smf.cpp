@@ -4,12 +4,19 @@
 //#endif
 
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <istream>
 #include <iostream>
 #include <math.h>
-#include <sstream>
+#include <cstddef>
+#include <cstring>
 #include <format>
+#include <future>
+#include <iterator>
+#include <sstream>
+#include <system_error>
+#include <thread>
 
 #include "./Smf.h"
 
@@ -40,102 +47,196 @@ namespace {
 		std::reverse(reinterpret_cast<uint8_t*>(&t), reinterpret_cast<uint8_t*>(&t) + sizeof(t));
 	}
 
-	class Read {
-		size_t m_readBytes = 0;
+	// メモリ上のデータの読み込み (データのコピーをせずに、ポインタを進めながら読む)
+	class ReadMemory {
+		const uint8_t* m_p;
+		const uint8_t* const m_end;
 	public:
-		std::istream& is;
-		Read(std::istream& is_)
-			:is(is_) {
+		ReadMemory(std::span<const uint8_t> data)
+			: m_p(data.data())
+			, m_end(data.data() + data.size()) {
+		}
+		size_t remain()const {
+			return static_cast<size_t>(m_end - m_p);
 		}
-		const size_t readBytes()const {
-			return m_readBytes;
+		uint8_t readByte() {
+			if (m_p == m_end) throw std::runtime_error("size error");
+			return *m_p++;
 		}
 		template <typename T> T read() {
 			typename std::remove_const<T>::type buf;
-			if (is.read(reinterpret_cast<char*>(&buf), sizeof(buf)).gcount() < sizeof(buf)) {
-				throw std::runtime_error("size error");
-			}
-			m_readBytes += sizeof(buf);
+			if (remain() < sizeof(buf)) throw std::runtime_error("size error");
+			std::memcpy(&buf, m_p, sizeof(buf));
+			m_p += sizeof(buf);
 			return buf;
 		}
 
-		std::vector<uint8_t> read(size_t bytes) {
-			std::vector<uint8_t> buf(bytes);
-			if (bytes > 0) {
-				const auto readSize = is.read(reinterpret_cast<char*>(buf.data()), buf.size()).gcount();
-				m_readBytes += readSize;
-				buf.resize(readSize);
+		// bytes 分読み込む (足りなければ読めた分のみ)
+		std::span<const uint8_t> read(size_t bytes) {
+			const auto data = std::span<const uint8_t>(m_p, (std::min)(bytes, remain()));
+			m_p += data.size();
+			return data;
+		}
+
+		// 可変長数値を取得 (utility::readVariableValue と同じ)
+		uint64_t readVariableValue() {
+			uint64_t value = 0;
+			for (size_t i = 0; i < 8; i++) {	// failsafe
+				const uint8_t b = readByte();
+				value = (value << 7) | (b & 0x7f);
+				if (!(b & 0x80)) return value;
 			}
-			return buf;
+			throw std::runtime_error("variable value error");
 		}
 
 		void unget() {
-			if (!is.unget()) throw std::runtime_error("unget error");	// 1Byte戻す
-			m_readBytes--;
+			m_p--;		// 1Byte戻す
 		}
 
 	};
-};
-
-
-std::vector<uint8_t> Smf::getFileImage() const
-{
-	std::list<std::vector<uint8_t>> trackData;
-
-	for (auto& track : tracks) {
-		std::vector<uint8_t> v;
 
-		size_t position = 0;		// 現在位置
-
-		auto fEvent = [&](const Event& event) {
+	// トラックのイベントを track に追加 (エラー時は例外。それまでのイベントは track に残る)
+	void parseTrack(std::span<const uint8_t> trackBinary, Smf::Track& track, std::ostream& log) {
+		using namespace midi;
+		ReadMemory tr(trackBinary);
+		track.events.reserve(trackBinary.size() / 4);	// 大半が4Byte程度のイベントとして確保
+		std::uint64_t currentPosition = 0;		// 現在位置
+
+		struct {
+			uint8_t before = 0;	// 直前のステータス(0x80～0xef)
+			uint8_t beforeF = 0;	// 直前のステータス(0x80～0xff) 違反チェック用
+		}runningStatus;
+
+		while (tr.remain() > 0) {
+			currentPosition += tr.readVariableValue();		// 現在位置 += デルタタイム
+
+			// status 読み込み
+			const auto status = [&] {
+				const uint8_t status = tr.readByte();
+				if (!(status & 0x80)) {					// status 省略なら直前値を採用
+					tr.unget();							// 1Byte戻す
+					if (runningStatus.beforeF >= 0xf0) {	// 仕様違反チェック
+						log << "[warning] running status transition after SysEx/Meta. recovery with previous status " << std::format("0x{:02x}", runningStatus.before & 0xf0) << std::endl;
+						runningStatus.beforeF = runningStatus.before;
+						return runningStatus.before;
+					}
+					return runningStatus.before;
+				}
+				runningStatus.beforeF = status;
+				if (status < 0xf0) runningStatus.before = status;
+				return status;
+			}();
 
-			{// DeltaTime
-				assert(event.first >= position);
-				const size_t deltaTime = event.first - position;		// DeltaTime
-				position = event.first;									// 現在位置更新
-				std::vector<uint8_t> s = midi::utility::getVariableValue(deltaTime);
-				v.insert(v.end(), std::make_move_iterator(s.begin()), std::make_move_iterator(s.end()));
+			switch (status & 0xf0) {
+			case EventNoteOff::statusByte: {
+				const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
+				track.events.emplace(currentPosition, status, a[0] & 0x7f, a[1] & 0x7f);
+				break;
 			}
-
-			{
-				std::vector<uint8_t> t = event.second->smfBytes();
-				v.insert(v.end(), std::make_move_iterator(t.begin()), std::make_move_iterator(t.end()));
+			case EventNoteOn::statusByte: {
+				const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
+				track.events.emplace(currentPosition, status, a[0] & 0x7f, a[1] & 0x7f);
+				break;
 			}
-
-		};
-
-		for (auto& event : track.events) {
-			fEvent(event);
-		}
-
-		// EndOfTrackがなければ付ける
-		[&] {
-			if (auto i = track.events.rbegin(); i != track.events.rend()) {		// 末尾が EndOfTrack ではないなら
-				if (auto meta = std::dynamic_pointer_cast<const midi::EventMeta>(i->second)) {
-					if (meta->type == midi::EventMeta::Type::endOfTrack) {
-						return;
+			case EventPolyphonicKeyPressure::statusByte: {
+				const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
+				track.events.emplace(currentPosition, status, a[0] & 0x7f, a[1] & 0x7f);
+				break;
+			}
+			case EventControlChange::statusByte: {
+				const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
+				track.events.emplace(currentPosition, status, a[0] & 0x7f, a[1] & 0x7f);
+				break;
+			}
+			case EventProgramChange::statusByte: {
+				const uint8_t n = tr.read<decltype(n)>();
+				track.events.emplace(currentPosition, status, n & 0x7f);
+				break;
+			}
+			case EventPitchBend::statusByte: {
+				const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
+				track.events.emplace(currentPosition, status, a[0] & 0x7f, a[1] & 0x7f);
+				break;
+			}
+			case EventChannelPressure::statusByte: {
+				const uint8_t n = tr.read<decltype(n)>();
+				track.events.emplace(currentPosition, status, n & 0x7f);
+				break;
+			}
+			default:
+				switch (status) {
+				case EventSystemExclusive::statusByteF0:
+				case EventSystemExclusive::statusByteF7: {
+					const auto len = tr.readVariableValue();		// データ長
+					const auto data = tr.read(len);
+					if (data.size() < len) log << "[warning] system exclusive data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
+					track.events.emplace(currentPosition, status, 0, data);
+					break;
+				}
+				case EventMeta::statusByte: {
+					const uint8_t type = tr.read<decltype(type)>();						// イベントタイプ
+					const auto len = tr.readVariableValue();		// データ長
+					const auto data = tr.read(len);
+					if (data.size() < len) log << "[warning] meta data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
+					track.events.emplace(currentPosition, status, type, data);
+
+					if (static_cast<EventMeta::Type>(type) == EventMeta::Type::endOfTrack) { // End of Track が現れたら当該トラックの残りデータは無視
+						tr.read(tr.remain());
 					}
+					break;
+				}
+
+				case 0xf1:	// MIDI Time Code Quarter Frame
+				case 0xf2:	// Song Position Pointer
+				case 0xf3:	// Song Select
+				case 0xf4:	// Reserved
+				case 0xf5:	// Reserved
+				case 0xf6:	// Tune Request
+				// case 0xf7:	// End of Exclusive
+				case 0xf8:	// Timing Clock
+				case 0xf9:	// Reserved
+				case 0xfa:	// Start
+				case 0xfb:	// Continue
+				case 0xfc:	// Stop
+				case 0xfd:	// Reserved
+				case 0xfe:	// Active Sense
+				// case 0xff:	// System Reset
+					break;		// これらは無視する。1バイトイベントとして次へ。
+				default:
+					throw std::runtime_error("unknown status byte");
+					break;
 				}
 			}
-			Event e(position, std::make_shared<midi::EventMeta>(midi::EventMeta::createEndOfTrack()));
-			fEvent(e);
-		}();
-
-		{// TrackChunk を先頭に挿入
-			TrackChunk trackChunk;
-			trackChunk.dataLength = static_cast<uint32_t>(v.size());
-			changeEndian(trackChunk.dataLength);
-			v.insert(v.begin(),
-				reinterpret_cast<const uint8_t*>(&trackChunk),
-				reinterpret_cast<const uint8_t*>(&trackChunk) + sizeof(trackChunk));
 		}
-
-		trackData.emplace_back(std::move(v));
 	}
+};
+
 
-	const HeaderChunk headerChunk = [&] {
+std::vector<uint8_t> Smf::getFileImage() const
+{
+	std::vector<uint8_t> result;
+	result.reserve([&] {		// 概算サイズ (デルタタイム1Byte + ステータス + データ2Byte)
+		size_t size = sizeof(HeaderChunk);
+		for (auto& track : tracks) size += sizeof(TrackChunk) + track.events.size() * 4 + 4;
+		return size;
+	}());
+
+	const auto append = [&result](const auto& t) {		// 構造体をそのまま (パディング無しのチャンクのヘッダ)
+		const auto offset = result.size();
+		result.resize(offset + sizeof(t));
+		std::memcpy(result.data() + offset, &t, sizeof(t));
+	};
+	const auto appendVariableValue = [&result](uint64_t n) {	// 可変長数値 (utility::getVariableValue と同じ)
+		std::array<uint8_t, 8> buf;
+		auto i = buf.size();
+		buf[--i] = n & 0x7f;
+		while ((n >>= 7) != 0 && i > 0) buf[--i] = static_cast<uint8_t>((n & 0x7f) | 0x80);
+		result.insert(result.end(), buf.begin() + i, buf.end());
+	};
+
+	{// HeaderChunk
 		HeaderChunk h;
-		h.trackCount = static_cast<uint16_t>(trackData.size());
+		h.trackCount = static_cast<uint16_t>(tracks.size());
 		h.format = h.trackCount > 1 ? 1 : 0;
 		h.division = timeBase;
 		// エンディアン変更
@@ -143,25 +244,64 @@ std::vector<uint8_t> Smf::getFileImage() const
 		changeEndian(h.format);
 		changeEndian(h.trackCount);
 		changeEndian(h.division);
-		return h;
-	}();
+		append(h);
+	}
+
+	for (auto& track : tracks) {
+		const auto chunkOffset = result.size();
+		append(TrackChunk());		// データ長は後で書き込む
 
-	std::vector<uint8_t> result(
-		reinterpret_cast<const uint8_t*>(&headerChunk),
-		reinterpret_cast<const uint8_t*>(&headerChunk) + sizeof(headerChunk));
+		size_t position = 0;		// 現在位置
+		bool endOfTrack = false;	// 末尾が EndOfTrack か
+		for (const auto& [eventPosition, event] : track.events) {
+			assert(eventPosition >= position);
+			appendVariableValue(eventPosition - position);		// DeltaTime
+			position = eventPosition;							// 現在位置更新
+
+			const auto& packed = event.packed();
+			switch (packed.status & 0xf0) {
+			case midi::EventProgramChange::statusByte:
+			case midi::EventChannelPressure::statusByte:
+				result.insert(result.end(), { packed.status, static_cast<uint8_t>(packed.data1 & 0x7f) });
+				break;
+			default:
+				if (packed.status < 0xf0) {
+					result.insert(result.end(), { packed.status, static_cast<uint8_t>(packed.data1 & 0x7f), static_cast<uint8_t>(packed.data2 & 0x7f) });
+				} else {
+					const auto data = event.data();
+					result.push_back(packed.status);
+					if (packed.status == midi::EventMeta::statusByte) result.push_back(packed.data1);	// Metaのイベントタイプ
+					appendVariableValue(data.size());
+					result.insert(result.end(), data.begin(), data.end());
+				}
+				break;
+			}
+			endOfTrack = packed.status == midi::EventMeta::statusByte && packed.data1 == static_cast<uint8_t>(midi::EventMeta::Type::endOfTrack);
+		}
+		if (!endOfTrack) {		// EndOfTrackがなければ付ける
+			result.insert(result.end(), { 0x00, midi::EventMeta::statusByte, static_cast<uint8_t>(midi::EventMeta::Type::endOfTrack), 0x00 });
+		}
 
-	for (auto& i : trackData) {
-		result.insert(result.end(), std::make_move_iterator(i.begin()), std::make_move_iterator(i.end()));
+		{// TrackChunk のデータ長を書き込む
+			auto dataLength = static_cast<uint32_t>(result.size() - chunkOffset - sizeof(TrackChunk));
+			changeEndian(dataLength);
+			std::memcpy(result.data() + chunkOffset + offsetof(TrackChunk, dataLength), &dataLength, sizeof(dataLength));
+		}
 	}
 
 	return result;
 }
 
 Smf Smf::fromStream(std::istream& is) {
+	const std::vector<uint8_t> data{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+	return fromMemory(data);
+}
+
+Smf Smf::fromMemory(std::span<const uint8_t> data) {
 	using namespace midi;
 
 	Smf smf;
-	Read file(is);
+	ReadMemory file(data);
 
 	const auto headerChunk = [&file]() {
 		HeaderChunk c = file.read<decltype(c)>();
@@ -177,7 +317,12 @@ Smf Smf::fromStream(std::istream& is) {
 
 	smf.timeBase = headerChunk.division;
 
-	// トラックチャンク
+	// トラックチャンクの位置を先に取得 (データ長を読むだけ)
+	struct TrackBinary {
+		std::span<const uint8_t>	data;
+		bool						sizeError = false;	// データが足りない
+	};
+	std::vector<TrackBinary> trackBinaries;
 	std::exception_ptr ep;	// 例外保持
 	try {
 		for (size_t i = 0; i < headerChunk.trackCount; i++) {
@@ -189,144 +334,72 @@ Smf Smf::fromStream(std::istream& is) {
 				changeEndian(c.dataLength);
 				return c;
 			}();
+			const auto v = file.read(trackChunk.dataLength);
+			trackBinaries.push_back(TrackBinary{ v, v.size() < trackChunk.dataLength });
+		}
+	} catch (...) {
+		ep = std::current_exception();
+	}
 
-			const auto trackBinary = [&]() {
-				auto v = file.read(trackChunk.dataLength);
-				if (v.size() < trackChunk.dataLength) std::clog << "[warning] track data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
-				return std::string(v.begin(), v.end());
-			}();
-			std::istringstream iss(trackBinary);
-			Read tr(iss);
-
-			Smf::Track track;
+	// 各トラックは独立しているので並列にパースする
+	// ワーカー数は CPU 数まで(トラック数分のスレッドは作らない)。各ワーカーは未着手のトラックを順に取っていく
+#ifdef DISABLE_THREADS
+	constexpr auto asyncLaunch = std::launch::deferred;
+#else
+	constexpr auto asyncLaunch = std::launch::async;
+#endif
+	struct Parsed {
+		Smf::Track			track;
+		std::exception_ptr	ep;
+		std::string			log;	// 警告 (トラック順に出力する)
+	};
+	std::vector<Parsed> parsedTracks(trackBinaries.size());
+	std::atomic<size_t> nextTrack = 0;
+	const auto worker = [&] {
+		for (size_t i; (i = nextTrack++) < trackBinaries.size(); ) {
+			auto& parsed = parsedTracks[i];
 			try {
-				std::uint64_t currentPosition = 0;		// 現在位置
-
-				struct {
-					uint8_t before = 0;	// 直前のステータス(0x80～0xef)
-					uint8_t beforeF = 0;	// 直前のステータス(0x80～0xff) 違反チェック用
-				}runningStatus;
-
-				while (tr.readBytes() < trackBinary.size()) {
-					auto readVariableValue = [&tr] {					// 可変長数値を取得
-						return utility::readVariableValue([&] {return tr.read<uint8_t>(); });
-					};
-
-					currentPosition += readVariableValue();		// 現在位置 += デルタタイム
-
-					// status 読み込み
-					const auto status = [&] {
-						const uint8_t status = tr.read<decltype(status)>();
-						if (!(status & 0x80)) {					// status 省略なら直前値を採用
-							tr.unget();							// 1Byte戻す
-							if (runningStatus.beforeF >= 0xf0) {	// 仕様違反チェック
-								std::clog << "[warning] running status transition after SysEx/Meta. recovery with previous status " << std::format("0x{:02x}", runningStatus.before & 0xf0) << std::endl;
-								runningStatus.beforeF = runningStatus.before;
-								return runningStatus.before;
-							}
-							return runningStatus.before;
-						}
-						runningStatus.beforeF = status;
-						if (status < 0xf0) runningStatus.before = status;
-						return status;
-					}();
-
-					switch (status & 0xf0) {
-					case EventNoteOff::statusByte: {
-						const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
-						track.events.emplace(currentPosition, std::make_shared<EventNoteOff>(status & 0xf, a[0] & 0x7f, a[1] & 0x7f));
-						break;
-					}
-					case EventNoteOn::statusByte: {
-						const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
-						track.events.emplace(currentPosition, std::make_shared<EventNoteOn>(status & 0xf, a[0] & 0x7f, a[1] & 0x7f));
-						break;
-					}
-					case EventPolyphonicKeyPressure::statusByte: {
-						const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
-						track.events.emplace(currentPosition, std::make_shared<EventPolyphonicKeyPressure>(status & 0xf, a[0] & 0x7f, a[1] & 0x7f));
-						break;
-					}
-					case EventControlChange::statusByte: {
-						const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
-						track.events.emplace(currentPosition, std::make_shared<EventControlChange>(status & 0xf, a[0] & 0x7f, a[1] & 0x7f));
-						break;
-					}
-					case EventProgramChange::statusByte: {
-						const uint8_t n = tr.read<decltype(n)>();
-						track.events.emplace(currentPosition, std::make_shared<EventProgramChange>(status & 0xf, n & 0x7f));
-						break;
-					}
-					case EventPitchBend::statusByte: {
-						const std::array<uint8_t, 2> a = tr.read<decltype(a)>();
-						const auto n = ((a[0] & 0x7f) + (a[1] & 0x7f) * 0x80) - 8192;
-						track.events.emplace(currentPosition, std::make_shared<EventPitchBend>(status & 0xf, n));
-						break;
-					}
-					case EventChannelPressure::statusByte: {
-						const uint8_t n = tr.read<decltype(n)>();
-						track.events.emplace(currentPosition, std::make_shared<EventChannelPressure>(status & 0xf, n & 0x7f));
-						break;
-					}
-					default:
-						switch (status) {
-						case EventSystemExclusive::statusByteF0:
-						case EventSystemExclusive::statusByteF7: {
-							const auto len = readVariableValue();		// データ長
-							std::vector<uint8_t> v{ status };
-							const auto data = tr.read(len);
-							if (data.size() < len) std::clog << "[warning] system exclusive data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
-							v.insert(v.end(), data.begin(), data.end());
-							track.events.emplace(currentPosition, std::make_shared<EventSystemExclusive>(std::move(v)));
-							break;
-						}
-						case EventMeta::statusByte: {
-							const uint8_t type = tr.read<decltype(type)>();						// イベントタイプ
-							const auto len = readVariableValue();		// データ長
-							auto data = tr.read(len);
-							if (data.size() < len) std::clog << "[warning] meta data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
-							const auto spEvent = std::make_shared<EventMeta>(static_cast<EventMeta::Type>(type), std::move(data));
-							track.events.emplace(currentPosition, spEvent);
-
-							if (spEvent->type == EventMeta::Type::endOfTrack) { // End of Track が現れたら当該トラックの残りデータは無視
-								tr.read(trackChunk.dataLength - tr.readBytes());
-							}
-							break;
-						}
-
-						case 0xf1:	// MIDI Time Code Quarter Frame
-						case 0xf2:	// Song Position Pointer
-						case 0xf3:	// Song Select
-						case 0xf4:	// Reserved
-						case 0xf5:	// Reserved
-						case 0xf6:	// Tune Request
-						// case 0xf7:	// End of Exclusive
-						case 0xf8:	// Timing Clock
-						case 0xf9:	// Reserved
-						case 0xfa:	// Start
-						case 0xfb:	// Continue
-						case 0xfc:	// Stop
-						case 0xfd:	// Reserved
-						case 0xfe:	// Active Sense
-						// case 0xff:	// System Reset
-							break;		// これらは無視する。1バイトイベントとして次へ。
-						default:
-							throw std::runtime_error("unknown status byte");
-							break;
-						}
-					}
+				std::ostringstream log;
+				try {
+					parseTrack(trackBinaries[i].data, parsed.track, log);
+				} catch (...) {
+					parsed.ep = std::current_exception();
 				}
+				parsed.log = log.str();
 			} catch (...) {
-				if (track.events.size() > 0) {
-					smf.tracks.emplace_back(std::move(track));
-				}
-				throw;
+				parsed.ep = std::current_exception();
 			}
-			smf.tracks.emplace_back(std::move(track));
 		}
-	} catch (...) {
-		ep = std::current_exception();
+	};
+	{
+		const size_t workerCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), trackBinaries.size());
+		std::vector<std::future<void>> workers;
+		for (size_t i = 1; i < workerCount; i++) {		// 呼び出し元のスレッドも1ワーカーとして働く
+			try {
+				workers.emplace_back(std::async(asyncLaunch, worker));
+			} catch (const std::system_error&) {		// スレッドを作れない場合は、作れた分のワーカーで続行する
+				break;
+			}
+		}
+		worker();
+		for (auto& w : workers) w.wait();
+	}
+
+	// 先頭から順に取り込み、エラーのトラックがあればそれ以降は捨てる
+	for (size_t i = 0; i < parsedTracks.size(); i++) {
+		auto& parsed = parsedTracks[i];
+		if (trackBinaries[i].sizeError) std::clog << "[warning] track data size error." << std::endl;	// データが足りない(が、エラーにはせず続行)
+		std::clog << parsed.log;
+		if (parsed.ep) {
+			if (parsed.track.events.size() > 0) {
+				smf.tracks.emplace_back(std::move(parsed.track));
+			}
+			ep = parsed.ep;
+			break;
+		}
+		smf.tracks.emplace_back(std::move(parsed.track));
 	}
+
 	if (ep) {
 		try {
 			std::rethrow_exception(ep);
@@ -348,11 +421,53 @@ Smf Smf::convertTimebase(const Smf& smf, int timeBase) {
 	const auto mul = static_cast<double>(dst.timeBase) / smf.timeBase;
 	for (auto& track : smf.tracks) {
 		Track dstTrack;
-		for (auto& [position, event] : track.events) {
+		dstTrack.events.reserve(track.events.size());
+		for (const auto& [position, event] : track.events) {
 			const auto dstPos = static_cast<decltype(position)>(std::round(position * mul));
 			dstTrack.events.emplace(dstPos, event);
 		}
-		dst.tracks.push_back(dstTrack);
+		dst.tracks.push_back(std::move(dstTrack));
 	}
 	return dst;
 }
+
+void Smf::Events::emplace(size_t position, const midi::Event& event) {
+	using namespace midi;
+	if (auto e = dynamic_cast<const EventNoteOff*>(&event)) {
+		emplace(position, EventNoteOff::statusByte | (e->channel & 0xf), e->note & 0x7f, e->velocity & 0x7f);
+	} else if (auto e = dynamic_cast<const EventNoteOn*>(&event)) {
+		emplace(position, EventNoteOn::statusByte | (e->channel & 0xf), e->note & 0x7f, e->velocity & 0x7f);
+	} else if (auto e = dynamic_cast<const EventPolyphonicKeyPressure*>(&event)) {
+		emplace(position, EventPolyphonicKeyPressure::statusByte | (e->channel & 0xf), e->note & 0x7f, e->pressure & 0x7f);
+	} else if (auto e = dynamic_cast<const EventControlChange*>(&event)) {
+		emplace(position, EventControlChange::statusByte | (e->channel & 0xf), static_cast<uint8_t>(e->type) & 0x7f, e->value & 0x7f);
+	} else if (auto e = dynamic_cast<const EventProgramChange*>(&event)) {
+		emplace(position, EventProgramChange::statusByte | (e->channel & 0xf), e->programNo & 0x7f);
+	} else if (auto e = dynamic_cast<const EventChannelPressure*>(&event)) {
+		emplace(position, EventChannelPressure::statusByte | (e->channel & 0xf), e->channelPressure & 0x7f);
+	} else if (auto e = dynamic_cast<const EventPitchBend*>(&event)) {
+		const int n = e->pitchBend + 8192;
+		emplace(position, EventPitchBend::statusByte | (e->channel & 0xf), n & 0x7f, n / 0x80 & 0x7f);
+	} else if (auto e = dynamic_cast<const EventSystemExclusive*>(&event)) {
+		if (e->data.empty() || (e->data[0] != EventSystemExclusive::statusByteF0 && e->data[0] != EventSystemExclusive::statusByteF7)) {
+			throw std::runtime_error("invalid system exclusive");		// 先頭はステータスバイト(0xf0|0xf7)であること
+		}
+		emplace(position, e->data[0], 0, std::span(e->data).subspan(1));
+	} else if (auto e = dynamic_cast<const EventMeta*>(&event)) {
+		emplace(position, EventMeta::statusByte, static_cast<uint8_t>(e->type), e->data);
+	} else {
+		throw std::runtime_error("unknown event");
+	}
+}
+
+void Smf::Events::merge(const Events& events) {
+	flush();
+	const auto middle = static_cast<std::ptrdiff_t>(m_events.size());
+	m_events.reserve(m_events.size() + events.size());
+	for (const auto& [position, event] : events) {		// 一旦末尾に追加してから統合
+		auto packed = event.packed();
+		if (packed.status >= 0xf0) packed.blob = addBlob(event.data());
+		m_events.push_back(packed);
+	}
+	std::inplace_merge(m_events.begin(), m_events.begin() + middle, m_events.end(), [](const Packed& a, const Packed& b) { return a.position < b.position; });
+}
@@ -5,6 +5,10 @@
 #include <ostream>
 #include <map>
 #include <memory>
+#include <span>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 
 #include "MidiEvent.h"
 
@@ -12,9 +16,238 @@ namespace rlib::midi {
 
 	class Smf {
 	public:
-		using Events = std::multimap<size_t, std::shared_ptr<const midi::Event>>;	// <position,Event>
+		// イベント列 (位置順に並べた固定長レコード + SysEx/Metaのデータ領域)
+		// Eventオブジェクトはイベント毎には保持せず、参照時に必要なものだけ生成する
+		class Events {
+		public:
+			struct Packed {
+				size_t		position = 0;	// 位置
+				uint32_t	blob = 0;		// SysEx/Metaのデータ位置(m_blob内のオフセット)
+				uint8_t		status = 0;		// ステータスバイト(0x80～0xef | 0xf0 | 0xf7 | 0xff)
+				uint8_t		data1 = 0;		// データ1 (Metaの場合はイベントタイプ)
+				uint8_t		data2 = 0;		// データ2
+			};
+
+			// イベント参照 (参照先の Events が変更されるまで有効)
+			class Ref {
+				const Events* m_events = nullptr;
+				const Packed* m_packed = nullptr;
+			public:
+				Ref() {}
+				Ref(const Events& events, const Packed& packed)
+					: m_events(&events)
+					, m_packed(&packed) {
+				}
+				const Packed& packed()const { return *m_packed; }
+				uint8_t status()const { return m_packed->status; }
+
+				// SysEx/Metaのデータ (SysExは先頭のステータスバイトを含まない)
+				std::span<const uint8_t> data()const {
+					if (m_packed->status < 0xf0) return {};
+					return m_events->blob(m_packed->blob);
+				}
+
+				// 対応する Event を一時的に生成して f(const EventXxx&) を呼ぶ
+				template <typename F> auto visit(F&& f)const -> std::invoke_result_t<F, const EventNoteOn&> {
+					const auto& p = *m_packed;
+					const uint8_t ch = p.status & 0xf;
+					switch (p.status & 0xf0) {
+					case EventNoteOff::statusByte:					return f(EventNoteOff(ch, p.data1, p.data2));
+					case EventNoteOn::statusByte:					return f(EventNoteOn(ch, p.data1, p.data2));
+					case EventPolyphonicKeyPressure::statusByte:	return f(EventPolyphonicKeyPressure(ch, p.data1, p.data2));
+					case EventControlChange::statusByte:			return f(EventControlChange(ch, p.data1, p.data2));
+					case EventProgramChange::statusByte:			return f(EventProgramChange(ch, p.data1));
+					case EventChannelPressure::statusByte:			return f(EventChannelPressure(ch, p.data1));
+					case EventPitchBend::statusByte:				return f(EventPitchBend(ch, static_cast<int16_t>((p.data1 + p.data2 * 0x80) - 8192)));
+					default:
+						break;
+					}
+					const auto d = data();
+					if (p.status == EventMeta::statusByte) {
+						return f(EventMeta(static_cast<EventMeta::Type>(p.data1), std::vector<uint8_t>(d.begin(), d.end())));
+					}
+					std::vector<uint8_t> v{ p.status };
+					v.insert(v.end(), d.begin(), d.end());
+					return f(EventSystemExclusive(v));
+				}
+
+				// Eventオブジェクトを生成して取得
+				std::shared_ptr<const midi::Event> get()const {
+					return visit([](const auto& e) -> std::shared_ptr<const midi::Event> {
+						return std::make_shared<std::decay_t<decltype(e)>>(e);
+					});
+				}
+			};
+
+			using value_type = std::pair<size_t, Ref>;	// <position,Event>
+
+			class const_iterator {
+				const Events* m_events = nullptr;
+				const Packed* m_p = nullptr;
+			public:
+				using iterator_concept = std::random_access_iterator_tag;
+				using iterator_category = std::input_iterator_tag;
+				using value_type = Events::value_type;
+				using difference_type = std::ptrdiff_t;
+				using reference = value_type;
+				struct pointer {
+					value_type v;
+					const value_type* operator->()const { return &v; }
+				};
+
+				const_iterator() {}
+				const_iterator(const Events& events, const Packed* p)
+					: m_events(&events)
+					, m_p(p) {
+				}
+				reference operator*()const { return value_type(m_p->position, Ref(*m_events, *m_p)); }
+				pointer operator->()const { return pointer{ **this }; }
+				reference operator[](difference_type n)const { return *(*this + n); }
+				const_iterator& operator++() { ++m_p; return *this; }
+				const_iterator& operator--() { --m_p; return *this; }
+				const_iterator operator++(int) { auto i = *this; ++m_p; return i; }
+				const_iterator operator--(int) { auto i = *this; --m_p; return i; }
+				const_iterator& operator+=(difference_type n) { m_p += n; return *this; }
+				const_iterator& operator-=(difference_type n) { m_p -= n; return *this; }
+				friend const_iterator operator+(const_iterator i, difference_type n) { return i += n; }
+				friend const_iterator operator+(difference_type n, const_iterator i) { return i += n; }
+				friend const_iterator operator-(const_iterator i, difference_type n) { return i -= n; }
+				friend difference_type operator-(const const_iterator& a, const const_iterator& b) { return a.m_p - b.m_p; }
+				friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.m_p == b.m_p; }
+				friend auto operator<=>(const const_iterator& a, const const_iterator& b) { return a.m_p <=> b.m_p; }
+			};
+			using iterator = const_iterator;
+			using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+		private:
+			mutable std::vector<Packed>	m_events;	// 位置順
+			mutable std::vector<Packed>	m_pending;	// 位置を遡って追加されたイベント(追加順)。参照時にまとめて m_events へ統合する
+			std::vector<uint8_t>		m_blob;		// SysEx/Metaのデータ ([uint32_t データ長][データ] の連続)
+
+			std::span<const uint8_t> blob(uint32_t offset)const {
+				uint32_t size;
+				std::memcpy(&size, m_blob.data() + offset, sizeof(size));
+				return std::span<const uint8_t>(m_blob.data() + offset + sizeof(size), size);
+			}
+			uint32_t addBlob(std::span<const uint8_t> data) {
+				const auto offset = m_blob.size();
+				const auto size = static_cast<uint32_t>(data.size());
+				if (offset + sizeof(size) + data.size() > UINT32_MAX) throw std::runtime_error("event data too large");
+				m_blob.insert(m_blob.end(), reinterpret_cast<const uint8_t*>(&size), reinterpret_cast<const uint8_t*>(&size) + sizeof(size));
+				m_blob.insert(m_blob.end(), data.begin(), data.end());
+				return static_cast<uint32_t>(offset);
+			}
+			void insert(const Packed& packed) {
+				if (m_events.empty() || m_events.back().position <= packed.position) {	// 大抵は末尾への追加
+					m_events.push_back(packed);
+					return;
+				}
+				m_pending.push_back(packed);	// 位置を遡る追加は溜めておき、参照時に一度だけ整列する
+			}
+			// m_pending を m_events へ統合 (同じ位置のイベントは追加順)
+			// 以降に末尾へ追加されるイベントは m_pending のどれよりも後ろの位置なので、追加順は保たれる
+			// 参照側の const メンバから呼ぶため、同じ Events を複数スレッドから同時に読み始めないこと
+			void flush()const {
+				if (m_pending.empty()) return;
+				const auto less = [](const Packed& a, const Packed& b) { return a.position < b.position; };
+				std::stable_sort(m_pending.begin(), m_pending.end(), less);
+				const auto middle = static_cast<std::ptrdiff_t>(m_events.size());
+				m_events.insert(m_events.end(), m_pending.begin(), m_pending.end());
+				std::inplace_merge(m_events.begin(), m_events.begin() + middle, m_events.end(), less);
+				m_pending.clear();
+				m_pending.shrink_to_fit();
+			}
+		public:
+			bool empty()const { return m_events.empty() && m_pending.empty(); }
+			size_t size()const { return m_events.size() + m_pending.size(); }
+			void reserve(size_t size) { m_events.reserve(size); }
+
+			const_iterator begin()const { flush(); return const_iterator(*this, m_events.data()); }
+			const_iterator end()const { flush(); return const_iterator(*this, m_events.data() + m_events.size()); }
+			const_reverse_iterator rbegin()const { return const_reverse_iterator(end()); }
+			const_reverse_iterator rend()const { return const_reverse_iterator(begin()); }
+
+			// チャンネルイベント追加
+			void emplace(size_t position, uint8_t status, uint8_t data1, uint8_t data2 = 0) {
+				assert(status >= 0x80 && status < 0xf0);
+				insert(Packed{ position, 0, status, data1, data2 });
+			}
+			// SysEx/Metaイベント追加 (status:0xf0|0xf7|0xff, data1:Metaのイベントタイプ)
+			void emplace(size_t position, uint8_t status, uint8_t data1, std::span<const uint8_t> data) {
+				assert(status >= 0xf0);
+				insert(Packed{ position, addBlob(data), status, data1, 0 });
+			}
+			// 他の Events のイベントを位置を変えて追加
+			void emplace(size_t position, const Ref& ref) {
+				auto packed = ref.packed();
+				packed.position = position;
+				if (packed.status >= 0xf0) packed.blob = addBlob(ref.data());
+				insert(packed);
+			}
+			// Eventオブジェクトから追加
+			void emplace(size_t position, const midi::Event& event);
+
+			// 位置順に並んだ events を統合する (同じ位置のイベントは既存のものの後ろ)
+			void merge(const Events& events);
+		};
 		using Event = Events::value_type;
 
+		// 複数の Events を位置順に統合しながら順次取り出す (コピーはせず、各 Events の読み出し位置のヒープで選ぶ)
+		// 同じ位置のイベントは add した順、同じ Events 内では格納順
+		template <typename Tag> class EventMerger {
+		public:
+			struct Item {
+				size_t			position;
+				Events::Ref		event;
+				Tag				tag;
+			};
+		private:
+			struct Cursor {
+				Events::const_iterator	current;
+				Events::const_iterator	end;
+				Tag						tag;
+			};
+			std::vector<Cursor>	m_cursors;
+			std::vector<size_t>	m_heap;		// 読み出し中の m_cursors のインデックス(先頭が次のイベント)
+
+			bool greater(size_t a, size_t b)const {
+				const auto pa = m_cursors[a].current->first;
+				const auto pb = m_cursors[b].current->first;
+				return pa != pb ? pa > pb : a > b;
+			}
+			void pushHeap() { std::push_heap(m_heap.begin(), m_heap.end(), [this](size_t a, size_t b) { return greater(a, b); }); }
+			void popHeap() { std::pop_heap(m_heap.begin(), m_heap.end(), [this](size_t a, size_t b) { return greater(a, b); }); }
+		public:
+			void add(const Events& events, Tag tag) {
+				if (events.empty()) return;
+				m_cursors.push_back(Cursor{ events.begin(), events.end(), std::move(tag) });
+				m_heap.push_back(m_cursors.size() - 1);
+				pushHeap();
+			}
+			bool empty()const { return m_heap.empty(); }
+
+			// 次のイベントの位置
+			size_t position()const {
+				assert(!empty());
+				return m_cursors[m_heap.front()].current->first;
+			}
+
+			// 次のイベントを取り出す
+			Item pop() {
+				assert(!empty());
+				popHeap();
+				auto& cursor = m_cursors[m_heap.back()];
+				const auto [position, event] = *cursor.current;
+				Item item{ position, event, cursor.tag };
+				if (++cursor.current != cursor.end) {
+					pushHeap();
+				} else {
+					m_heap.pop_back();
+				}
+				return item;
+			}
+		};
+
 		class Track {
 		public:
 			Events	events;
@@ -44,6 +277,9 @@ namespace rlib::midi {
 
 		static Smf fromStream(std::istream& is);
 
+		// メモリ上の SMF データから (トラック毎のコピーをせずに直接パースする)
+		static Smf fromMemory(std::span<const uint8_t> data);
+
 		static Smf convertTimebase(const Smf& smf, int timeBase);
 
 	};
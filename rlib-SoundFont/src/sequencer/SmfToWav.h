@@ -28,59 +28,63 @@ namespace rlib {
 		{
 			TempoListT<double>							tempoList;
 			std::map<std::string, midi::Smf::Events>	mapEvents;
-			const auto mul = TempoListT<double>::timeBase / smf.timeBase;			// timebaseを480にする
+			const auto toPosition = [timeBase = static_cast<uint64_t>(smf.timeBase)](size_t position) {	// timebaseを480にする (480より細かい分解能は切り捨て)
+				return static_cast<size_t>(position * static_cast<uint64_t>(TempoListT<double>::timeBase) / timeBase);
+			};
 
 			for (auto& track : smf.tracks) {
 
 				std::string instrumentName;
+				std::map<std::string, midi::Smf::Events>	trackEvents;	// トラック内の instrument 毎のイベント(後で mapEvents へ統合する)
 				midi::Smf::Events *pEvents = nullptr;
 				const auto getEvents = [&]{
 					if (!pEvents) {
-						auto& events = mapEvents[instrumentName];
+						auto& events = trackEvents[instrumentName];
 						pEvents = &events;
 					}
 					return pEvents;
 				};
 				
-				for (auto& [position, event] : track.events) {
-					if (auto meta = std::dynamic_pointer_cast<const midi::EventMeta>(event)) {
+				for (const auto& [position, event] : track.events) {
+					if (event.status() == midi::EventMeta::statusByte) {
+						const auto meta = std::static_pointer_cast<const midi::EventMeta>(event.get());
 						switch (meta->type) {
 						case  midi::EventMeta::Type::instrumentName:
 							instrumentName = meta->getText();
 							pEvents = nullptr;
 							break;
 						case midi::EventMeta::Type::tempo:
-							tempoList.insert(position * mul, static_cast<typename decltype(tempoList)::Type>(meta->getTempo()));
+							tempoList.insert(toPosition(position), static_cast<typename decltype(tempoList)::Type>(meta->getTempo()));
 							break;
 						default:
-							getEvents()->emplace(position * mul, event);
+							getEvents()->emplace(toPosition(position), event);
 							break;
 						}
 					} else {
-						getEvents()->emplace(position * mul, event);
+						getEvents()->emplace(toPosition(position), event);
 					}
 				}
+
+				for (auto& [instrument, events] : trackEvents) {
+					mapEvents[instrument].merge(events);
+				}
 			}
 
 			return SmfToWav(std::move(tempoList), std::move(mapEvents));
 		}
 
-		template <typename T = double, typename Callback> void toPcm(const std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>>& midiModuleMap, Callback callback) const {
+		// eventQuantum:イベント間のレンダリングの最小サンプル数(0:イベント毎)
+		//   大量のイベントがある場合に短いレンダリングの繰り返しを避ける。イベントは最大でこのサンプル数だけ早まる
+		template <typename T = double, typename Callback> void toPcm(const std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>>& midiModuleMap, Callback callback, size_t eventQuantum = 0) const {
 			if (midiModuleMap.empty()) throw std::runtime_error("MidiModules is empty.");
 			const auto sampleRate = midiModuleMap.begin()->second.get().getSampleRate();	// sampleRate は最初のものを採用。異なるものチェックは要検討
 
-			const auto combinedEvents = [&] {
-				struct Info {
-					std::shared_ptr<const midi::Event>	event;
-					std::reference_wrapper<midi::MidiModuleBase<T>>	refMidiModule;
-				};
-				std::multimap<size_t, Info> combinedEvents;	// <position,Info>
+			auto combinedEvents = [&] {		// 各 instrument のイベントを位置順に取り出す
+				midi::Smf::EventMerger<std::reference_wrapper<midi::MidiModuleBase<T>>> combinedEvents;
 				for (auto& [instrument, events] : m_mapEvents) {
 					auto it = midiModuleMap.find(instrument);
 					midi::MidiModuleBase<T>& midiModule = it != midiModuleMap.end() ? it->second : midiModuleMap.begin()->second;
-					for (auto& [position, event] : events) {
-						combinedEvents.emplace(position, Info{ event, midiModule });
-					}
+					combinedEvents.add(events, midiModule);
 				}
 				return combinedEvents;
 			}();
@@ -99,8 +103,7 @@ namespace rlib {
 			}renderedSize{ sampleRate };
 
 			{// 先頭のイベントまでの無音
-				auto current = combinedEvents.cbegin();
-				const auto nextTime = m_tempoList.getTime(current->first);
+				const auto nextTime = m_tempoList.getTime(combinedEvents.position());
 				const auto needSize = renderedSize.next(nextTime);
 				std::vector<midi::StereoSample<T>> samples(needSize);
 				callback(samples);
@@ -131,21 +134,21 @@ namespace rlib {
 				callback(samples);
 			};
 
-			for (auto current = combinedEvents.cbegin(); current != combinedEvents.end(); ) {
+			while (!combinedEvents.empty()) {
 
-				const auto next = combinedEvents.upper_bound(current->first);
-				for (auto it = current; it != next; it++) {
-					midi::MidiModuleBase<T>& midiModule = it->second.refMidiModule;
-					midiModule.setMidiEvent(*it->second.event);
+				const auto current = combinedEvents.position();
+				while (!combinedEvents.empty() && combinedEvents.position() == current) {
+					const auto item = combinedEvents.pop();
+					midi::MidiModuleBase<T>& midiModule = item.tag;
+					item.event.visit([&](const midi::Event& ev) { midiModule.setMidiEvent(ev); });
 				}
 
-				if (next != combinedEvents.end()) {
-					const auto nextTime = m_tempoList.getTime(next->first);
+				if (!combinedEvents.empty()) {
+					const auto nextTime = m_tempoList.getTime(combinedEvents.position());
+					if (eventQuantum > 0 && static_cast<std::uintmax_t>(nextTime * sampleRate) < renderedSize.m_current + eventQuantum) continue;	// 次のイベントまで短いなら、続けてイベントを処理
 					const auto needSize = renderedSize.next(nextTime);
 					render(needSize);
 				}
-
-				current = next;
 			}
 
 			const auto step = sampleRate / 5;	// 余韻を0.2秒ずつレンダリング
@@ -161,7 +164,7 @@ namespace rlib {
 
 		}
 
-		template <typename T = double> Wav toWav(const std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>>& midiModuleMap) const {
+		template <typename T = double> Wav toWav(const std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>>& midiModuleMap, size_t eventQuantum = 0) const {
 			if (midiModuleMap.empty()) throw std::runtime_error("MidiModules is empty.");
 			const auto sampleRate = midiModuleMap.begin()->second.get().getSampleRate();	// sampleRate は最初のものを採用。異なるものチェックは要検討
 
@@ -172,15 +175,7 @@ namespace rlib {
 			auto& wavData = wav.data<Wav::Stereo<float>>();
 
 			{// 必要バッファ確保
-				const auto timeLength = m_tempoList.getTime([&]{
-					uint64_t max = 0;
-					for (auto& i : m_mapEvents) {
-						if (!i.second.empty()) {
-							max = std::max(max, static_cast<decltype(max)>(i.second.rbegin()->first));
-						}
-					}
-					return max;
-				}());
+				const auto timeLength = getTimeLength();
 				if (timeLength > 10 * 60) {		// (とりあえず)10分以上はエラー
 					throw std::runtime_error("Songs must be no longer than 10 minutes.");
 				}
@@ -189,14 +184,60 @@ namespace rlib {
 
 			toPcm(midiModuleMap, [&](auto& samples) {
 				wavData.insert(wavData.end(), std::make_move_iterator(samples.begin()), std::make_move_iterator(samples.end()));
-			});
+			}, eventQuantum);
 
 			return wav;
 		}
 
+		// 最後のイベントの時刻(秒)
+		double getTimeLength() const {
+			uint64_t max = 0;
+			for (auto& i : m_mapEvents) {
+				if (!i.second.empty()) {
+					max = std::max(max, static_cast<decltype(max)>(i.second.rbegin()->first));
+				}
+			}
+			return m_tempoList.getTime(max);
+		}
+
+		// wav を os へ順次出力 (曲全体をメモリに保持しないので toWav の10分の制限なし。wav の形式上データは Wav::maxDataSize バイトまで)
+		// ヘッダのデータ長は最後に書き戻す。os がシークできない(パイプ等)場合はデータ長を最大値にしたヘッダのまま出力する
+		template <typename T = double> void exportWav(const std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>>& midiModuleMap, std::ostream& os, size_t eventQuantum = 0) const {
+			if (midiModuleMap.empty()) throw std::runtime_error("MidiModules is empty.");
+			const auto sampleRate = midiModuleMap.begin()->second.get().getSampleRate();
+			using Sample = Wav::Stereo<float>;
+			constexpr uint64_t maxDataSize = Wav::maxDataSize<Sample>();
+			if (getTimeLength() * sampleRate * sizeof(Sample) > maxDataSize) throw std::runtime_error("wav data too large.");	// 書き始める前に弾く
+
+			const auto begin = os.tellp();
+			const bool seekable = begin != decltype(begin)(-1);
+			Wav::exportHeader<Sample>(os, sampleRate, seekable ? 0 : static_cast<uint32_t>(maxDataSize));		// データ長は後で書き込む
+			uint64_t dataSize = 0;
+			std::vector<Sample> buffer;
+			toPcm(midiModuleMap, [&](auto& samples) {
+				if (dataSize + samples.size() * sizeof(Sample) > maxDataSize) throw std::runtime_error("wav data too large.");	// 余韻で超える場合
+				buffer.assign(samples.begin(), samples.end());
+				os.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(Sample));
+				dataSize += buffer.size() * sizeof(Sample);
+			}, eventQuantum);
+
+			if (seekable) {
+				const auto end = os.tellp();
+				os.seekp(begin);
+				Wav::exportHeader<Sample>(os, sampleRate, static_cast<uint32_t>(dataSize));
+				os.seekp(end);
+			}
+			if (os.fail()) throw std::runtime_error("wav export error.");
+		}
+
 #ifndef __EMSCRIPTEN__
-		// フォルダを指定することで必要なmapMidiModuleを生成
-		template <typename T = double> auto makeMidiModules(const std::filesystem::path& defaultSoundfont, const std::filesystem::path& soundfontDir, uint32_t sampleRate = 44100) const {
+		// フォルダを指定することで必要なmapMidiModuleを生成 (fidelity:FM/PSG音源のチップの忠実度)
+		// soundfontEngine,maxVoices:SoundFont音源のレンダリング方式と最大ボイス数(Engine::voice のみ。0:無制限)
+		// fmEngine:FM音源のレンダリング方式 psgOscillator:PSG音源の波形の生成方法
+		template <typename T = double> auto makeMidiModules(const std::filesystem::path& defaultSoundfont, const std::filesystem::path& soundfontDir, uint32_t sampleRate = 44100, fm::Fidelity fidelity = fm::Fidelity::max,
+			typename soundfont::MidiModuleT<T>::Engine soundfontEngine = soundfont::MidiModuleT<T>::Engine::note, size_t maxVoices = 0,
+			typename fm::MidiModuleT<T>::Engine fmEngine = fm::MidiModuleT<T>::Engine::note,
+			typename fm::psg::MidiModuleT<T>::Oscillator psgOscillator = fm::psg::MidiModuleT<T>::Oscillator::chip) const {
 			struct {
 				std::map<std::string, std::shared_ptr<midi::MidiModuleBase<T>>> instances;
 				std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<T>>> refMap;
@@ -218,7 +259,9 @@ namespace rlib {
 						spSoundfont = std::make_shared<const soundfont::Soundfont>(soundfont::Soundfont::fromStream(fs));
 					}
 					if (bDefault) spDefaultSoundfont = spSoundfont;		// デフォルトSoundfontの読み込みだったならキープ
-					return std::make_shared<soundfont::MidiModuleT<T>>(spSoundfont, sampleRate);
+					auto sp = std::make_shared<soundfont::MidiModuleT<T>>(spSoundfont, sampleRate, soundfontEngine);
+					sp->setMaxVoices(maxVoices);
+					return sp;
 				} catch (std::exception& e) {
 					std::clog << "soundfont parse exception " << fullpath << " " << e.what() << std::endl;
 				} catch (...) {
@@ -235,12 +278,12 @@ namespace rlib {
 					if (!instrument.empty()) {
 
 						if (instrument == "fm") {									// FM音源なら
-							moduleMap[instrument] = std::make_shared<fm::MidiModuleT<T>>(sampleRate);
+							moduleMap[instrument] = std::make_shared<fm::MidiModuleT<T>>(sampleRate, fmEngine, fidelity);
 							continue;
 						}
 
 						if (instrument == "psg") {									// PSG(SSG)音源なら
-							moduleMap[instrument] = std::make_shared<fm::psg::MidiModuleT<T>>(sampleRate);
+							moduleMap[instrument] = std::make_shared<fm::psg::MidiModuleT<T>>(sampleRate, fidelity, psgOscillator);
 							continue;
 						}
 
@@ -270,8 +313,8 @@ namespace rlib {
 		}
 
 		// フォルダを指定することでwav生成まで行うユーティリティ
-		template <typename T = double> Wav toWavUsingPath(const std::filesystem::path& defaultSoundfont, const std::filesystem::path& soundfontDir, uint32_t sampleRate = 44100) const {
-			const auto midiModules = makeMidiModules<T>(defaultSoundfont, soundfontDir, sampleRate);
+		template <typename T = double> Wav toWavUsingPath(const std::filesystem::path& defaultSoundfont, const std::filesystem::path& soundfontDir, uint32_t sampleRate = 44100, fm::Fidelity fidelity = fm::Fidelity::max) const {
+			const auto midiModules = makeMidiModules<T>(defaultSoundfont, soundfontDir, sampleRate, fidelity);
 			return toWav<T>(midiModules.refMap);
 		}
 
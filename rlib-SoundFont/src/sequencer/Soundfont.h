@@ -163,6 +163,10 @@ namespace rlib::soundfont {
 			int16_t		modAmount = 0;								// 操作するジェネレータ量
 			uint16_t	amtSrcOper = 0;								// モジュレーション元その2(ピッチベンドレンジなど)
 			uint16_t	modTransOper = 0;							// 変化量は線形か？曲線か？
+
+			bool operator==(const SFMod&)const = default;
+			// 同一のモジュレータか (SoundFont 2.01 9.5.1 src,dest,amtSrc が一致するもの)
+			bool isIdentical(const SFMod& m)const { return srcOper == m.srcOper && destOper == m.destOper && amtSrcOper == m.amtSrcOper; }
 		};
 
 		struct SFPresetHeader {				// phdrチャンク用の構造体
@@ -190,8 +194,8 @@ namespace rlib::soundfont {
 			uint32_t		dwSampleRate;		// 音声波形データのサンプリングレート
 			uint8_t			byOriginalPitch;	// オリジナルの音程
 			int8_t			chPitchCorrection;	// オリジナルの音程に対してのcent単位のチューニング
-			uint16_t		wSampleLink;		// typeが1の場合…0、2(4)の場合…左(右)のSFSampleHeaderへのインデックス TODO:よくわからんので未対応
-			SFSampleLink	sfSampleType;		// 音声波形データのタイプ TODO:よくわからんので未対応
+			uint16_t		wSampleLink;		// typeが1の場合…0、2(4)の場合…左(右)のSFSampleHeaderへのインデックス
+			SFSampleLink	sfSampleType;		// 音声波形データのタイプ
 
 			std::string getName()const {
 				std::vector<int8_t> v(std::begin(achSampleName), std::begin(achSampleName) + std::size(achSampleName));
@@ -203,7 +207,7 @@ namespace rlib::soundfont {
 
 		struct Gen {			// プリセットバッグ
 			std::shared_ptr<const GeneratorMap>	generator = std::make_shared<GeneratorMap>();
-			std::vector<SFMod>					mods;
+			std::shared_ptr<const std::vector<SFMod>>	mods = std::make_shared<std::vector<SFMod>>();
 		};
 
 		struct Doc {
@@ -382,10 +386,10 @@ namespace rlib::soundfont {
 				return b;
 			};
 			const auto modToVector = [](const auto& mods, auto begin, auto end) {
-				std::vector<SFMod> result(end - begin);
+				const auto result = std::make_shared<std::vector<SFMod>>(end - begin);
 				for (auto i = begin; i < end; i++) {
 					const auto& g = mods.at(i);
-					auto& m = result[i - begin];
+					auto& m = (*result)[i - begin];
 					m.srcOper = g.srcOper;
 					m.destOper = static_cast<GenOperator>(g.destOper);
 					m.modAmount = g.modAmount;
@@ -445,6 +449,52 @@ namespace rlib::soundfont {
 	// SoundFont を扱いやすい形式にしたもの
 	class Soundfont {
 	public:
+		using ModulatorList = std::vector<Parse::SFMod>;
+
+		// デフォルトモジュレータ (SoundFont 2.01 8.4)
+		static const ModulatorList& getDefaultModulators() {
+			static const ModulatorList list = {
+				{ 0x0502, GenOperator::initialAttenuation,	960,	0x0000, 0 },	// 8.4.1 ベロシティ → 音量
+				{ 0x0102, GenOperator::initialFilterFc,		-2400,	0x0000, 0 },	// 8.4.2 ベロシティ → フィルタカットオフ
+				{ 0x000D, GenOperator::vibLfoToPitch,		50,		0x0000, 0 },	// 8.4.3 チャンネルプレッシャー → ビブラート
+				{ 0x0081, GenOperator::vibLfoToPitch,		50,		0x0000, 0 },	// 8.4.4 CC1(モジュレーション) → ビブラート
+				{ 0x0587, GenOperator::initialAttenuation,	960,	0x0000, 0 },	// 8.4.5 CC7(ボリューム) → 音量
+				{ 0x028A, GenOperator::pan,					1000,	0x0000, 0 },	// 8.4.6 CC10(パン) → パン
+				{ 0x058B, GenOperator::initialAttenuation,	960,	0x0000, 0 },	// 8.4.7 CC11(エクスプレッション) → 音量
+				{ 0x00DB, GenOperator::reverbEffectsSend,	200,	0x0000, 0 },	// 8.4.8 CC91 → リバーブ
+				{ 0x00DD, GenOperator::chorusEffectsSend,	200,	0x0000, 0 },	// 8.4.9 CC93 → コーラス
+				{ 0x020E, GenOperator::fineTune,			12700,	0x0010, 0 },	// 8.4.10 ピッチホイール(×ピッチホイールセンシティビティ) → 音程
+			};
+			return list;
+		}
+
+		// ゾーンに適用するモジュレータ一覧 (デフォルト + インストルメント + プリセット)
+		// ローカルゾーンは同一のグローバルゾーンのものを置き換え、インストルメントは同一のデフォルトを置き換え、プリセットは同一のものへ加算する
+		static ModulatorList getModulators(const ModulatorList& instLocal, const ModulatorList& instGlobal, const ModulatorList& presetLocal, const ModulatorList& presetGlobal) {
+			const auto merge = [](const ModulatorList& local, const ModulatorList& global) {
+				ModulatorList result = global;
+				for (const auto& m : local) {
+					const auto it = std::find_if(result.begin(), result.end(), [&](const auto& r) { return r.isIdentical(m); });
+					if (it != result.end()) *it = m;
+					else result.push_back(m);
+				}
+				return result;
+			};
+
+			ModulatorList result = getDefaultModulators();
+			for (const auto& m : merge(instLocal, instGlobal)) {
+				const auto it = std::find_if(result.begin(), result.end(), [&](const auto& r) { return r.isIdentical(m); });
+				if (it != result.end()) *it = m;
+				else result.push_back(m);
+			}
+			for (const auto& m : merge(presetLocal, presetGlobal)) {
+				const auto it = std::find_if(result.begin(), result.end(), [&](const auto& r) { return r.isIdentical(m); });
+				if (it != result.end()) it->modAmount = static_cast<int16_t>(std::clamp(it->modAmount + m.modAmount, -32768, 32767));
+				else result.push_back(m);
+			}
+			return result;
+		}
+
 		template <typename T = double> static std::variant<std::monostate, T, int16_t, std::pair<uint8_t, uint8_t>, enumSampleMode> getGenAmount(
 			GenOperator ope, const GeneratorMap& instLocal, const GeneratorMap& instGlobal, const GeneratorMap& presetLocal, const GeneratorMap& presetGlobal
 		) {
@@ -573,7 +623,8 @@ namespace rlib::soundfont {
 			uint32_t					sampleRate = 0;						// 音声波形データのサンプリングレート
 			uint8_t						originalKey = 0;					// 音声波形データのオリジナルの音程 60の時、音声波形はC4(中央のド、261.62Hz)の音程で録音された波形であることを示す
 			int8_t						pitchCorrection = 0;				// オリジナルの音程に対しての補正(単位cent)
-//			SFSampleLink				type = SFSampleLink::monoSample;	// 音声波形データのタイプ
+			SFSampleLink				type = SFSampleLink::monoSample;	// 音声波形データのタイプ
+			uint32_t					index = 0;							// 通し番号(0～getSampleCount()-1 レンダラーのキャッシュ用)
 			
 			// 波形データ(実数に変換後の波形データ)
 			template <typename T = double> std::vector<T> createSample(const Soundfont& sf)const {
@@ -587,13 +638,29 @@ namespace rlib::soundfont {
 				return sample;
 			}
 
+			// ステレオの波形データ(実数に変換後、L,R を交互に並べた波形データ)
+			template <typename T = double> std::vector<T> createSample(const Soundfont& sf, const SampleBody& right)const {
+				const auto l = createSample<T>(sf);
+				const auto r = right.createSample<T>(sf);
+				std::vector<T> sample((std::min)(l.size(), r.size()) * 2);
+				for (size_t i = 0; i < sample.size() / 2; i++) {
+					sample[i * 2] = l[i];
+					sample[i * 2 + 1] = r[i];
+				}
+				return sample;
+			}
+
 		};
 
 		struct InstrumentSample {
 			std::pair<uint8_t, uint8_t>			keyRange = { 0,0x7f };	// マッピングするキー(ノートNo)の範囲
 			std::pair<uint8_t, uint8_t>			velRange = { 0,0x7f };	// マッピングするベロシティの範囲
 			std::shared_ptr<const GeneratorMap>	genInstLocal = std::make_shared<GeneratorMap>();
+			std::shared_ptr<const ModulatorList>	modInstLocal = std::make_shared<ModulatorList>();
 			std::shared_ptr<const SampleBody>	spSample = std::make_shared<SampleBody>();
+			std::shared_ptr<const GeneratorMap>	genInstLocalRight;		// ステレオの場合の右のゾーンのジェネレータ(モノラルなら nullptr)
+			std::shared_ptr<const SampleBody>	spSampleRight;			// ステレオの場合の右の波形(モノラルなら nullptr。spSample は左)
+			uint32_t							index = 0;				// ゾーンの通し番号(0～getZoneCount()-1 レンダラーのキャッシュ用)
 		};
 		struct Instrument {
 #ifndef NDEBUG
@@ -602,6 +669,8 @@ namespace rlib::soundfont {
 #endif
 			std::shared_ptr<const GeneratorMap>	genInstGlobal = std::make_shared<GeneratorMap>();
 			std::shared_ptr<const GeneratorMap>	genPresetLocal = std::make_shared<GeneratorMap>();
+			std::shared_ptr<const ModulatorList>	modInstGlobal = std::make_shared<ModulatorList>();
+			std::shared_ptr<const ModulatorList>	modPresetLocal = std::make_shared<ModulatorList>();
 			std::vector<InstrumentSample>		samples;
 
 			Instrument(){}
@@ -618,6 +687,7 @@ namespace rlib::soundfont {
 			const std::pair<uint16_t, uint16_t>	presetNo;		// <bank,presetno>
 			std::string							name;
 			std::shared_ptr<const GeneratorMap>	genPresetGlobal = std::make_shared<GeneratorMap>();		// グローバルゾーン
+			std::shared_ptr<const ModulatorList>	modPresetGlobal = std::make_shared<ModulatorList>();	// グローバルゾーン
 			std::vector<Instrument>				instruments;
 
 			struct Less {
@@ -652,12 +722,17 @@ namespace rlib::soundfont {
 			uint8_t		velocity = 0;
 		};
 		std::vector<InstrumentRefer> getPreset(const PresetKey& presetKey) const noexcept {
-			std::vector<InstrumentRefer> result;
-			const auto itPreset = m_doc.presets.find({ presetKey.bank ,presetKey.presetNo });
-			if (itPreset == m_doc.presets.end()) {
-				return result;
+			const Preset* preset = findPreset(presetKey.bank, presetKey.presetNo);
+			if (!preset) {
+				return {};
 			}
-			for (auto& instrument : itPreset->instruments) {
+			return getPreset(*preset, presetKey);
+		}
+
+		// 解決済のプリセットから note,velocity に該当するゾーンを取得 (presetKey の bank,presetNo は参照しない)
+		static std::vector<InstrumentRefer> getPreset(const Preset& preset, const PresetKey& presetKey) noexcept {
+			std::vector<InstrumentRefer> result;
+			for (auto& instrument : preset.instruments) {
 				for (const InstrumentSample& sample : instrument.samples) {
 					if (presetKey.note < sample.keyRange.first || presetKey.note > sample.keyRange.second) {
 						continue;
@@ -665,17 +740,24 @@ namespace rlib::soundfont {
 					if (presetKey.velocity < sample.velRange.first || presetKey.velocity > sample.velRange.second) {
 						continue;
 					}
-					result.emplace_back(InstrumentRefer{ *itPreset, instrument, sample });
+					result.emplace_back(InstrumentRefer{ preset, instrument, sample });
 				}
 			}
 			return result;
 		}
 
+		// プリセット検索 (無ければ nullptr)
+		const Preset* findPreset(uint16_t bank, uint16_t presetNo) const noexcept {
+			const auto it = m_doc.presets.find(std::pair(bank, presetNo));
+			return it != m_doc.presets.end() ? &*it : nullptr;
+		}
+
 		static Soundfont fromStream(std::istream& is) {
 			Parse sf = Parse::fromStream(is);
 
 			std::set<Preset, typename Preset::Less>	presets;
 			std::map<uint16_t,std::shared_ptr<const SampleBody>> mapSample;
+			uint32_t zoneCount = 0;
 
 			for(auto &ph : sf.m_doc.presetHeaders ){
 				Preset preset(ph.bank, ph.presetno);
@@ -693,6 +775,7 @@ namespace rlib::soundfont {
 							assert(false);
 						}
 						preset.genPresetGlobal = pbag.generator;
+						preset.modPresetGlobal = pbag.mods;
 						// break; チェックを行うのでbreakしない
 					}
 				}
@@ -707,6 +790,7 @@ namespace rlib::soundfont {
 						instrument.name = ih.name;
 #endif
 						instrument.genPresetLocal = pbag.generator;
+						instrument.modPresetLocal = pbag.mods;
 
 						for (const auto& ibag : ih.bags) {		// 最初にグローバルゾーン
 							if (const auto sampleID = getNo(*ibag.generator, GenOperator::sampleID); !sampleID) {
@@ -715,15 +799,18 @@ namespace rlib::soundfont {
 									assert(false);
 								}
 								instrument.genInstGlobal = ibag.generator;
+								instrument.modInstGlobal = ibag.mods;
 								// break; チェックを行うのでbreakしない
 							}
 						}
+						std::vector<int16_t> sampleIDs;		// instrument.samples に対応する sampleID
 						for (const auto& ibag : ih.bags) {
 							const auto sampleID = getNo(*ibag.generator, GenOperator::sampleID);	// sampleID
 							if (!sampleID) continue;
 
 							InstrumentSample sample;
 							sample.genInstLocal = ibag.generator;
+							sample.modInstLocal = ibag.mods;
 
 							auto& spSample = mapSample[*sampleID];
 							if (!spSample) {
@@ -735,7 +822,8 @@ namespace rlib::soundfont {
 								sp->name = sh.getName();
 #endif
 
-								//sp->type = sh.sfSampleType;
+								sp->type = sh.sfSampleType;
+								sp->index = *sampleID;
 								sp->originalKey = sh.byOriginalPitch;
 								sp->pitchCorrection = sh.chPitchCorrection;
 
@@ -781,6 +869,11 @@ namespace rlib::soundfont {
 							}
 
 							instrument.samples.emplace_back(std::move(sample));
+							sampleIDs.emplace_back(*sampleID);
+						}
+						linkStereoSamples(instrument, sampleIDs, sf.m_doc.shdr);
+						for (auto& sample : instrument.samples) {
+							sample.index = zoneCount++;
 						}
 						preset.instruments.emplace_back(std::move(instrument));
 					}
@@ -791,7 +884,8 @@ namespace rlib::soundfont {
 				}
 			}
 
-			return Soundfont(std::move(sf.m_doc.info), std::move(sf.m_doc.smpl), std::move(presets));
+			const auto sampleCount = static_cast<uint32_t>(sf.m_doc.shdr.size());
+			return Soundfont(std::move(sf.m_doc.info), std::move(sf.m_doc.smpl), std::move(presets), zoneCount, sampleCount);
 		}
 
 		Soundfont(Soundfont&&) = default;
@@ -811,19 +905,63 @@ namespace rlib::soundfont {
 #endif
 
 	private:
+		// リンクされたステレオサンプル(左右のゾーン)を左のゾーン1つにまとめる
+		// 左右で波形の長さ・ループ・音程・ジェネレータ(pan以外)が一致する場合のみ。一致しなければモノラルのゾーン2つのまま
+		static void linkStereoSamples(Instrument& instrument, const std::vector<int16_t>& sampleIDs, const std::vector<Parse::SFSampleHeader>& shdr) {
+			const auto withoutPan = [](const GeneratorMap& map) {
+				GeneratorMap m = map;
+				m.erase(GenOperator::sampleID);
+				m.erase(GenOperator::pan);
+				return m;
+			};
+			auto& samples = instrument.samples;
+			std::vector<bool> linked(samples.size());		// まとめたゾーン
+			std::vector<bool> merged(samples.size());		// 左へまとめた右のゾーン(破棄対象)
+			for (size_t l = 0; l < samples.size(); l++) {
+				const auto& left = *samples[l].spSample;
+				if (linked[l] || left.type != SFSampleLink::leftSample) continue;
+				for (size_t r = 0; r < samples.size(); r++) {
+					const auto& right = *samples[r].spSample;
+					if (linked[r] || right.type != SFSampleLink::rightSample) continue;
+					if (shdr.at(sampleIDs[l]).wSampleLink != static_cast<uint16_t>(sampleIDs[r])) continue;
+					if (samples[l].keyRange != samples[r].keyRange || samples[l].velRange != samples[r].velRange) continue;
+					if (left.sampleRate != right.sampleRate || left.originalKey != right.originalKey || left.pitchCorrection != right.pitchCorrection ||
+						left.loop != right.loop || left.point.second - left.point.first != right.point.second - right.point.first) continue;
+					if (withoutPan(*samples[l].genInstLocal) != withoutPan(*samples[r].genInstLocal)) continue;
+					if (*samples[l].modInstLocal != *samples[r].modInstLocal) continue;
+
+					samples[l].spSampleRight = samples[r].spSample;
+					samples[l].genInstLocalRight = samples[r].genInstLocal;
+					linked[l] = linked[r] = merged[r] = true;
+					break;
+				}
+			}
+			size_t n = 0;
+			for (size_t i = 0; i < samples.size(); i++) {
+				if (merged[i]) continue;
+				if (n != i) samples[n] = std::move(samples[i]);
+				n++;
+			}
+			samples.erase(samples.begin() + n, samples.end());
+		}
+
 		struct {
 			FileInfo								fileInfo;
 			std::vector<int16_t>					smpl;
 			std::set<Preset, typename Preset::Less>	presets;
+			uint32_t								zoneCount = 0;		// ゾーン(InstrumentSample)数
+			uint32_t								sampleCount = 0;	// 波形(SampleBody)数
 		}m_doc;
 
-		Soundfont(FileInfo&& fileInfo, std::vector<int16_t>&& smpl, std::set<Preset, typename Preset::Less>&& presets)
-			: m_doc{ std::move(fileInfo),std::move(smpl), std::move(presets) }
+		Soundfont(FileInfo&& fileInfo, std::vector<int16_t>&& smpl, std::set<Preset, typename Preset::Less>&& presets, uint32_t zoneCount, uint32_t sampleCount)
+			: m_doc{ std::move(fileInfo),std::move(smpl), std::move(presets), zoneCount, sampleCount }
 		{}
 	public:
 		const decltype(m_doc)& doc()const {
 			return m_doc;
 		}
+		uint32_t getZoneCount()const { return m_doc.zoneCount; }
+		uint32_t getSampleCount()const { return m_doc.sampleCount; }
 	};
 
 
@@ -5,6 +5,7 @@
 
 #include "../sequencer/MidiEvent.h"
 #include "../sequencer/MidiModule.h"
+#include "../sequencer/Effects.h"
 #include "SoundfontRenderer.h"
 
 
@@ -12,6 +13,19 @@ namespace rlib::soundfont {
 
 
 	template <typename T = double> class MidiModuleT : public midi::MidiModuleBase<T> {
+	public:
+		// レンダリングエンジン
+		enum class Engine {
+			note,		// ノート単位でレンダリング(ノート毎に非同期実行)
+			voice,		// 全ボイスを SoA 配列で保持し一括レンダリング (RendererT::VoiceEngine)
+		};
+		// 名前からレンダリングエンジンを取得 ("note" | "voice")
+		static Engine toEngine(std::string_view name) {
+			if (name == "note") return Engine::note;
+			if (name == "voice") return Engine::voice;
+			throw std::runtime_error("unknown soundfont engine.");
+		}
+	private:
 
 		using Bit14 = midi::utility::Bit14;
 
@@ -19,6 +33,8 @@ namespace rlib::soundfont {
 			const uint8_t	m_channel;
 			uint16_t		m_bank = 0;
 			uint8_t			m_programNo = 0;
+			const typename Soundfont::Preset*	m_preset = nullptr;				// (m_bank,m_programNo) のプリセット (無ければ nullptr)
+			const typename Soundfont::Preset*	m_presetFallback = nullptr;		// 対象バンクに音が無い場合に使う bank 0 のプリセット
 			uint8_t			m_volume = 100;			// 0～127
 			uint8_t			m_expression = 127;		// 0～127
 			uint8_t			m_pan = 64;				// 0～127
@@ -54,7 +70,9 @@ namespace rlib::soundfont {
 			std::optional<Bit14>	m_rpn;
 			Bit14					m_dataEntry;
 
-			std::map<uint8_t, std::list<std::shared_ptr<typename RendererT<T>::Note>>>	m_notes;
+			ModulatorSources		m_sources;		// モジュレータの入力元
+
+			midi::NoteTable<typename RendererT<T>::Note>	m_notes;		// 発音中のノート
 
 			Channel(uint8_t channel)
 				:m_channel(channel)
@@ -65,70 +83,105 @@ namespace rlib::soundfont {
 				}
 			}
 
-			struct Less {
-				typedef void is_transparent;
-				bool operator()(const Channel& a, const Channel& b)				const { return a.m_channel < b.m_channel; }
-				bool operator()(const decltype(m_channel) a, const Channel& b)	const { return a < b.m_channel; }
-				bool operator()(const Channel& a, const decltype(m_channel) b)	const { return a.m_channel < b; }
-			};
-
 		};
-		std::set<Channel, typename Channel::Less>	m_channels;
+		std::array<Channel, 16>	m_channels = midi::makeChannels<Channel>();
 		uint16_t	m_masterVolume = 16383;	// マスターボリューム 0-～16383 (14bit)
 
-		Channel& ensureChannel(uint8_t channel) {
-			if (auto i = m_channels.find(channel); i != m_channels.end() ){
-				return const_cast<Channel&>(*i);
+		Channel& getChannel(uint8_t channel) {
+			return m_channels[channel & 0xf];
+		}
+
+		// volume,expression,pan,masterVolume を掛け合わせたl,r振幅値を取得(必要なら再計算)
+		const std::pair<T, T>& ensureGain(Channel& channel)const {
+			if (!channel.m_gain) {
+				const T n = midi::volumeGainTable<T>[channel.m_volume] * midi::volumeGainTable<T>[channel.m_expression] * (m_masterVolume * (static_cast<T>(1.0) / 16383)); // volume,expression,masterVolume
+				const auto& pan = midi::panGainTable<T>[channel.m_pan];
+				channel.m_gain = { n * pan.first, n * pan.second };
+			}
+			return *channel.m_gain;
+		}
+
+		// (bank,programNo) からプリセットを解決 (ノートオン毎の検索を避けるため、変更時のみ)
+		void resolvePreset(Channel& channel) {
+			const auto& soundfont = *m_renderer.m_soundfont;
+			channel.m_preset = soundfont.findPreset(channel.m_bank, channel.m_programNo);
+			channel.m_presetFallback = (channel.m_bank != 0 && channel.m_bank != 128) ? soundfont.findPreset(0, channel.m_programNo) : nullptr;
+		}
+
+		// モジュレータの入力元の変化を発音中のボイスへ反映
+		void modulate(Channel& channel, ModulatorSources::Type type, uint8_t cc = 0) {
+			if (m_engine == Engine::voice) {
+				m_voiceEngine.modulate(channel.m_channel, channel.m_sources, type, cc);
+				return;
+			}
+			for (auto& voice : channel.m_notes) {
+				voice.note->modulate(channel.m_sources, type, cc);
 			}
-			auto i = m_channels.emplace(channel);
-			return const_cast<Channel&>(*i.first);
 		}
 
 		void eventNoteOn(const midi::Event& event) {
 			const midi::EventNoteOn &ev = static_cast<decltype(ev)>(event);
 			if (ev.velocity == 0) return eventNoteOff(event);	// noteoff?
 
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			typename Soundfont::PresetKey key;
 			key.bank = channel.m_bank;
 			key.presetNo = channel.m_programNo;
 			key.note = ev.note + channel.m_coarseTune;
 			key.velocity = ev.velocity;
 
-			const auto makeRenderer = [&](const typename Soundfont::PresetKey key) {
-				return std::make_shared<typename RendererT<T>::Note>(std::move(m_renderer.createNote(key)));
+			if (m_engine == Engine::voice) {
+				if ((!channel.m_preset || m_voiceEngine.noteOn(ev.channel, ev.note, *channel.m_preset, key, channel.m_sources) == 0) && channel.m_presetFallback) {	// 対象バンクに音がないなら
+					key.bank = 0;
+					m_voiceEngine.noteOn(ev.channel, ev.note, *channel.m_presetFallback, key, channel.m_sources);		// bank 0 で試行
+				}
+				return;
+			}
+
+			const auto makeRenderer = [&](const typename Soundfont::Preset& preset, const typename Soundfont::PresetKey key) {
+				return std::make_shared<typename RendererT<T>::Note>(std::move(m_renderer.createNote(preset, key)));
 			};
-			auto sp = makeRenderer(key);
-			if (sp->isFinished() && (key.bank != 0 && key.bank != 128)) {		// 対象バンクに音がないなら
+			std::shared_ptr<typename RendererT<T>::Note> sp;
+			if (channel.m_preset) {
+				sp = makeRenderer(*channel.m_preset, key);
+			}
+			if ((!sp || sp->isFinished()) && channel.m_presetFallback) {		// 対象バンクに音がないなら
 				key.bank = 0;
-				sp = makeRenderer(key);		// bank 0 で試行
+				sp = makeRenderer(*channel.m_presetFallback, key);		// bank 0 で試行
 			}
-			if( !sp->isFinished() ){
-				channel.m_notes[ev.note].push_back(sp);
+			if (sp && !sp->isFinished()) {
+				sp->modulate(channel.m_sources);
+				for (auto& voice : channel.m_notes) {		// 排他クラス(ハイハットのOpen、Close等)
+					voice.note->chokeExclusive(*sp);
+				}
+				channel.m_notes.add(ev.note, sp);
 			}
 		}
 
 		void eventNoteOff(const midi::Event& event) {
 			const midi::EventNote& ev = static_cast<decltype(ev)>(event);			// NoteOn から来ることもあるので midi::EventNote に
-			auto& channel = ensureChannel(ev.channel);
-			if (auto i = channel.m_notes.find(ev.note); i != channel.m_notes.end()) {
-				for (auto sp : i->second) {
-					if (!sp) throw std::runtime_error("eventNoteOff not note.");		// failsafe
-					sp->setKeyoff();
-				}
+			if (m_engine == Engine::voice) {
+				m_voiceEngine.noteOff(ev.channel, ev.note);
+				return;
 			}
+			auto& channel = getChannel(ev.channel);
+			channel.m_notes.forKey(ev.note, [](auto& note) {
+				note.setKeyoff();
+			});
 		}
 
 		void eventControlChange(const midi::Event& event) {
 			using namespace midi;
 			const EventControlChange& ev = static_cast<decltype(ev)>(event);
-			const auto channel = [&]()->Channel& {return ensureChannel(ev.channel); };
+			const auto channel = [&]()->Channel& {return getChannel(ev.channel); };
 
 			const auto procDataEntry = [&](auto& ch) {
 				if (ch.m_rpn) {
 					switch (static_cast<EventControlChange::RpnType>(ch.m_rpn->value)) {
 					case EventControlChange::RpnType::pitchBendRange:	// ベンドレンジ(ピッチ・ベンド・センシティビティ)
 						ch.m_pitch.set(ch.m_pitch.get().pitchBend, ch.m_dataEntry.msb);
+						ch.m_sources.pitchWheelSensitivity = ch.m_dataEntry.msb;
+						modulate(ch, ModulatorSources::Type::pitchWheelSensitivity);
 						break;
 					case EventControlChange::RpnType::fineTune: {
 						const int val = ch.m_dataEntry.value - 8192;
@@ -144,6 +197,13 @@ namespace rlib::soundfont {
 				}
 			};
 
+			{// モジュレータの入力元
+				auto& ch = channel();
+				const auto cc = static_cast<uint8_t>(static_cast<uint8_t>(ev.type) & 0x7f);
+				ch.m_sources.cc[cc] = ev.value & 0x7f;
+				modulate(ch, ModulatorSources::Type::cc, cc);
+			}
+
 			switch (ev.type) {
 			case EventControlChange::Type::volume: {
 				auto& ch = channel();
@@ -218,17 +278,28 @@ namespace rlib::soundfont {
 		void eventProgramChange(const midi::Event& event) {
 			using namespace midi;
 			const EventProgramChange& ev = static_cast<decltype(ev)>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			channel.m_programNo = ev.programNo;
 			channel.m_bank = channel.m_backselect.value;
+			resolvePreset(channel);
 		}
 
 		void eventPitchBend(const midi::Event& event) {
 			using namespace midi;
 			const auto& ev = static_cast<const EventPitchBend&>(event);
-			auto& channel = ensureChannel(ev.channel);
+			auto& channel = getChannel(ev.channel);
 			const auto& before = channel.m_pitch.get();
 			channel.m_pitch.set(ev.pitchBend, before.pitchBendRange);
+			channel.m_sources.pitchWheel = static_cast<uint16_t>(ev.pitchBend + 8192);
+			modulate(channel, ModulatorSources::Type::pitchWheel);
+		}
+
+		void eventChannelPressure(const midi::Event& event) {
+			using namespace midi;
+			const auto& ev = static_cast<const EventChannelPressure&>(event);
+			auto& channel = getChannel(ev.channel);
+			channel.m_sources.channelPressure = ev.channelPressure & 0x7f;
+			modulate(channel, ModulatorSources::Type::channelPressure);
 		}
 
 		void eventSystemExclusive(const midi::Event& event) {
@@ -251,14 +322,68 @@ namespace rlib::soundfont {
 				u.lsb = ev.data[5];
 				u.msb = ev.data[6];
 				m_masterVolume = u.value;
-				for (auto& ch : m_channels) const_cast<Channel&>(ch).m_gain = std::nullopt;	// 全チャンネル要再計算
+				for (auto& ch : m_channels) ch.m_gain = std::nullopt;	// 全チャンネル要再計算
 				return;
 			}
 
 		}
 
+		// エフェクトへの送りバスへ加算 (src が空なら送り無し)
+		static void addSend(std::vector<midi::StereoSample<T>>& dst, const std::vector<midi::StereoSample<T>>& src, const std::pair<T, T>& gain, size_t size) {
+			if (src.empty()) return;
+			if (dst.empty()) dst.assign(size, {});
+			for (size_t i = 0; i < src.size(); i++) {
+				dst[i].l += src[i].l * gain.first;
+				dst[i].r += src[i].r * gain.second;
+			}
+		}
+
+		// エフェクト(リバーブ,コーラス)処理 モジュール全体の送りバスをまとめて処理し result へ加算
+		void processEffects(std::vector<midi::StereoSample<T>>& result, size_t size) {
+			const bool reverb = !m_sends.reverb.empty();
+			const bool chorus = !m_sends.chorus.empty();
+			if (!reverb && !chorus && !m_reverb.isActive() && !m_chorus.isActive()) return;
+			result.resize(size);	// 残響があるので size 要素
+			m_reverb.process(reverb ? m_sends.reverb.data() : nullptr, result.data(), size);
+			m_chorus.process(chorus ? m_sends.chorus.data() : nullptr, result.data(), size);
+			m_sends.reverb.clear();
+			m_sends.chorus.clear();
+		}
+
+		// VoiceEngine でのレンダリング
+		std::vector<midi::StereoSample<T>> readSamplesVoiceEngine(size_t size) {
+			std::array<double, 16> pitch;
+			for (size_t i = 0; i < m_channels.size(); i++) {
+				pitch[i] = m_channels[i].m_fineTune + m_channels[i].m_pitch.get().result;
+			}
+			const auto lengths = m_voiceEngine.render(size, pitch, m_outputs);
+
+			std::vector<midi::StereoSample<T>> result((std::ranges::max)(lengths));
+			for (size_t ch = 0; ch < m_channels.size(); ch++) {
+				if (lengths[ch] == 0) continue;
+				const auto& gain = ensureGain(m_channels[ch]);
+				const auto& output = m_outputs[ch];
+				for (size_t i = 0; i < lengths[ch]; i++) {
+					result[i].l += output.dry[i].l * gain.first;
+					result[i].r += output.dry[i].r * gain.second;
+				}
+				addSend(m_sends.reverb, output.reverb, gain, size);
+				addSend(m_sends.chorus, output.chorus, gain, size);
+			}
+			processEffects(result, size);
+			return result;
+		}
+
 	public:
 		RendererT<T>	m_renderer;
+	private:
+		const Engine										m_engine;
+		typename RendererT<T>::VoiceEngine					m_voiceEngine{ m_renderer };
+		std::array<typename RendererT<T>::VoiceEngine::Output, 16>	m_outputs;	// VoiceEngine のチャンネル毎の出力先
+		typename RendererT<T>::Sends						m_sends;		// モジュール全体のエフェクトへの送りバス
+		midi::Reverb<T>										m_reverb;
+		midi::Chorus<T>										m_chorus;
+	public:
 
 		const uint32_t		m_sampleRate;
 		uint32_t getSampleRate()const override { return m_sampleRate; }
@@ -272,6 +397,7 @@ namespace rlib::soundfont {
 				{typeid(EventControlChange),	&MidiModuleT::eventControlChange	},
 				{typeid(EventProgramChange),	&MidiModuleT::eventProgramChange	},
 				{typeid(EventPitchBend),		&MidiModuleT::eventPitchBend		},
+				{typeid(EventChannelPressure),	&MidiModuleT::eventChannelPressure	},
 				{typeid(EventSystemExclusive),	&MidiModuleT::eventSystemExclusive	},
 			};
 			if (auto i = map.find(typeid(ev)); i != map.end()) {
@@ -281,78 +407,54 @@ namespace rlib::soundfont {
 
 		// レンダリング(波形データ出力（結果配列がsize未満なら完了=無音）
 		std::vector<midi::StereoSample<T>> readSamples(size_t size) override {
+			if (m_engine == Engine::voice) return readSamplesVoiceEngine(size);
 #ifdef DISABLE_THREADS
 			constexpr auto asyncLaunch = std::launch::deferred;
 #else
 			constexpr auto asyncLaunch = std::launch::async;
 #endif
-			std::vector<std::future<std::vector<typename midi::StereoSample<T>>>> futureChannels;
+			using Sends = typename RendererT<T>::Sends;
+			using Rendered = std::pair<std::vector<typename midi::StereoSample<T>>, Sends>;		// <出力, エフェクトへの送り>
+			std::vector<std::future<Rendered>> futureChannels;
 			for (auto& channel : m_channels) {
-				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel = const_cast<Channel&>(channel), size, asyncLaunch] {
-#if 0
-					const T pitch = channel.m_pitchBend / ((channel.m_pitchBend >= 0 ? 8191 : 8192) / static_cast<T>(2.0));	// とりあえずベンドレンジは2固定
-					std::vector<typename RendererT<T>::Sample> result(size);
-					for (auto it = channel.m_notes.begin(); it != channel.m_notes.end();) {
-						auto& list = it->second;
-						for (auto t = list.begin(); t != list.end();) {
-							auto sp = *t;
-							if (!sp) throw std::runtime_error("not released note.");	// failsafe
-							const auto samples = sp->render(size, pitch);
-							for (size_t i = 0; i < samples.size(); i++) {
-								result[i].l += samples[i].l;
-								result[i].r += samples[i].r;
-							}
-							if (sp->isFinished())	t = list.erase(t);		// 終わっていればlistから破棄
-							else					t++;
-						}
-						if (list.size() <= 0)	it = channel.m_notes.erase(it);			// 終わっていればmapから破棄
-						else					it++;
-					}
-#else
-					std::vector<std::future<decltype((*(channel.m_notes[0].begin()))->render(0, 0))>> futures;
-					for (const auto& note : channel.m_notes) {
-						for (const auto& sp : note.second) {
-							if (sp) {		// failsafe
-								const auto pitch = channel.m_fineTune + channel.m_pitch.get().result;
-								futures.emplace_back(std::async(asyncLaunch, [sp, size, pitch] {
-									return sp->render(size, pitch);
-								}));
-							}
-						}
+				if (channel.m_notes.empty()) continue;		// 発音中のノートが無いチャンネルは対象外
+				futureChannels.emplace_back(std::async(asyncLaunch, [self = &std::as_const(*this), &channel, size, asyncLaunch] {
+					std::vector<std::future<Rendered>> futures;
+					const auto pitch = channel.m_fineTune + channel.m_pitch.get().result;
+					for (const auto& voice : channel.m_notes) {
+						futures.emplace_back(std::async(asyncLaunch, [sp = voice.note, size, pitch] {
+							Rendered rendered;
+							rendered.first = sp->render(size, pitch, &rendered.second);
+							return rendered;
+						}));
 					}
 
-					std::vector<typename midi::StereoSample<T>> result;
+					Rendered result;
 					if (futures.size() <= 0) return result;
 
+					const auto gain = self->ensureGain(channel);
 					for (auto& f : futures) {
-						auto samples = f.get();
-						if (result.empty()) {		// 最初なら代入(加算不要)
-							result = std::move(samples);
+						auto [samples, sends] = f.get();
+						if (result.first.empty()) {		// 最初なら代入(加算不要)
+							result.first = std::move(samples);
 						} else {
-							result.resize(std::max(result.size(), samples.size()));
+							result.first.resize(std::max(result.first.size(), samples.size()));
 							for (size_t i = 0; i < samples.size(); i++) {
-								result[i].l += samples[i].l;
-								result[i].r += samples[i].r;
+								result.first[i].l += samples[i].l;
+								result.first[i].r += samples[i].r;
 							}
 						}
+						addSend(result.second.reverb, sends.reverb, gain, size);		// 音量処理込み
+						addSend(result.second.chorus, sends.chorus, gain, size);
 					}
-					for (auto n = channel.m_notes.begin(); n != channel.m_notes.end();) {
-						for (auto c = n->second.begin(); c != n->second.end();) {
-							c = (!(*c) || (*c)->isFinished()) ? n->second.erase(c) : ++c;	// 終わっていればlistから破棄
-						}
-						n = n->second.size() <= 0 ? channel.m_notes.erase(n) : ++n;	// 終わっていればmapから破棄
-					}
-#endif
-
-					// 音量処理(channel.m_gain算出)
-					if (!channel.m_gain) {
-						const T n = midi::volumeGainTable<T>[channel.m_volume] * midi::volumeGainTable<T>[channel.m_expression] * (self->m_masterVolume * (static_cast<T>(1.0) / 16383)); // volume,expression,masterVolume
-						const auto& pan = midi::panGainTable<T>[channel.m_pan];
-						channel.m_gain = { n * pan.first, n * pan.second };
-					}
-					for (auto& r : result) {
-						r.l *= channel.m_gain->first;
-						r.r *= channel.m_gain->second;
+					channel.m_notes.eraseIf([](const auto& voice) {
+						return voice.note->isFinished();		// 終わっていれば破棄
+					});
+
+					// 音量処理
+					for (auto& r : result.first) {
+						r.l *= gain.first;
+						r.r *= gain.second;
 					}
 
 					return result;
@@ -362,7 +464,9 @@ namespace rlib::soundfont {
 
 			std::vector<typename midi::StereoSample<T>> result;
 			for (auto& f : futureChannels) {
-				auto samples = f.get();
+				auto [samples, sends] = f.get();
+				addSend(m_sends.reverb, sends.reverb, { 1, 1 }, size);
+				addSend(m_sends.chorus, sends.chorus, { 1, 1 }, size);
 				if (result.empty()) {		// 最初なら代入(加算不要)
 					result = std::move(samples);
 				} else {
@@ -374,6 +478,8 @@ namespace rlib::soundfont {
 				}
 			}
 
+			processEffects(result, size);
+
 #if 0
 #if 0
 			// マスターボリューム（下げる）
@@ -406,16 +512,30 @@ namespace rlib::soundfont {
 
 		// Eventはリリース音も含めて全て処理されている状態か
 		bool isSilence()const override {
+			if (m_reverb.isActive() || m_chorus.isActive()) return false;		// 残響あり
+			if (m_engine == Engine::voice) return m_voiceEngine.empty();
 			for (auto& ch : m_channels) {
 				if (!ch.m_notes.empty()) return false;
 			}
 			return true;
 		}
 
-		MidiModuleT(std::shared_ptr<const Soundfont> sp, uint32_t sampleRate)
+		// 最大ボイス数(0:無制限) Engine::voice のみ有効
+		void setMaxVoices(size_t maxVoices) {
+			m_voiceEngine.setMaxVoices(maxVoices);
+		}
+
+		MidiModuleT(std::shared_ptr<const Soundfont> sp, uint32_t sampleRate, Engine engine = Engine::note)
 			:m_renderer(sp, sampleRate)
+			, m_engine(engine)
+			, m_reverb(sampleRate)
+			, m_chorus(sampleRate)
 			, m_sampleRate(sampleRate)
-		{}
+		{
+			for (auto& channel : m_channels) {
+				resolvePreset(channel);
+			}
+		}
 
 		MidiModuleT(MidiModuleT&&) = default;
 		MidiModuleT(const MidiModuleT&) = delete;
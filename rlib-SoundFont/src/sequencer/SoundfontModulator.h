@@ -0,0 +1,182 @@
+﻿#pragma once
+
+#include <array>
+#include <bitset>
+
+#include "Soundfont.h"
+
+namespace rlib::soundfont {
+
+	// モジュレータの入力元(コントローラ)の現在値 (チャンネル毎)
+	struct ModulatorSources {
+		std::array<uint8_t, 128>	cc = [] {						// コントロールチェンジ 0～127
+			std::array<uint8_t, 128> cc = {};
+			cc[7] = 100;		// ボリューム
+			cc[10] = 64;		// パン
+			cc[11] = 127;		// エクスプレッション
+			return cc;
+		}();
+		uint8_t		channelPressure = 0;			// チャンネルプレッシャー 0～127
+		uint16_t	pitchWheel = 8192;				// ピッチホイール 0～16383
+		uint8_t		pitchWheelSensitivity = 2;		// ピッチホイールセンシティビティ(半音単位)
+
+		enum class Type {		// 変更された入力元の種類(再評価の判定用)
+			cc,
+			channelPressure,
+			pitchWheel,
+			pitchWheelSensitivity,
+		};
+	};
+
+	// モジュレータの出力 (ジェネレータへの加算値)
+	template <typename T = double> struct ModulatorResult {
+		T	initialAttenuation = 0;		// 単位:cB
+		T	pan = 0;					// 単位:0.1%
+		T	pitch = 0;					// 単位:cent (fineTune, coarseTune)
+		T	reverbEffectsSend = 0;		// 単位:0.1%
+		T	chorusEffectsSend = 0;		// 単位:0.1%
+	};
+
+	// ゾーンのモジュレータ一覧を、反映可能なものだけの単純な命令列にしたもの
+	// ノートオン時と、参照している入力元が変化したときのみ評価する(サンプル毎の処理は無し)
+	template <typename T = double> class ModulatorProgramT {
+		enum class Dest : uint8_t {
+			initialAttenuation,
+			pan,
+			fineTune,
+			coarseTune,
+			reverbEffectsSend,
+			chorusEffectsSend,
+		};
+		struct Op {
+			uint16_t	src;			// sfModSrcOper
+			uint16_t	amtSrc;			// sfModAmtSrcOper
+			T			amount;			// modAmount
+			bool		absolute;		// sfModTransOper が絶対値か
+			Dest		dest;
+		};
+		std::vector<Op>		m_ops;
+
+		// 参照している入力元
+		std::bitset<128>	m_ccs;
+		std::bitset<4>		m_sources;	// ModulatorSources::Type
+
+		bool	m_gain = false;		// 音量,パンに影響するか
+		bool	m_pitch = false;	// 音程に影響するか
+
+		// 入力元の値(単極性:0.0～1.0 両極性:-1.0～1.0)
+		static T getSource(uint16_t src, const ModulatorSources& sources, uint8_t key, uint8_t velocity) {
+			const uint8_t index = src & 0x7f;
+			const bool isCC = (src & 0x80) != 0;
+			const bool negative = (src & 0x100) != 0;
+			const bool bipolar = (src & 0x200) != 0;
+			const uint8_t type = static_cast<uint8_t>(src >> 10);
+
+			const auto [value, range] = [&]()->std::pair<int, int> {
+				if (isCC) return { sources.cc[index], 128 };
+				switch (index) {
+				case 2:		return { velocity, 128 };					// Note-On Velocity
+				case 3:		return { key, 128 };						// Note-On Key Number
+				case 13:	return { sources.channelPressure, 128 };	// Channel Pressure
+				case 14:	return { sources.pitchWheel, 16384 };		// Pitch Wheel
+				case 16:	return { sources.pitchWheelSensitivity, 128 };	// Pitch Wheel Sensitivity
+				default:	return { 0, 128 };							// Poly Pressure 等(未対応)
+				}
+			}();
+			const int v = negative ? (range - 1) - value : value;
+
+			// 0.0～1.0 を曲線で返す
+			const auto curve = [type](T x)->T {
+				constexpr T k = static_cast<T>(40.0 / 96.0);		// -20/96 * log10((1-x)^2)
+				switch (type) {
+				case 1:		return x >= 1 ? 1 : (std::min)(static_cast<T>(1), -k * std::log10(1 - x));	// concave
+				case 2:		return x <= 0 ? 0 : (std::max)(static_cast<T>(0), 1 + k * std::log10(x));	// convex
+				case 3:		return x >= static_cast<T>(0.5) ? 1 : 0;									// switch
+				default:	return x;																	// linear
+				}
+			};
+			if (!bipolar) {
+				return curve(v / static_cast<T>(range - 1));
+			}
+			if (type == 3) return v >= range / 2 ? 1 : -1;		// switch
+			const int half = range / 2;
+			const T x = (v - half) / static_cast<T>(v >= half ? half - 1 : half);	// -1.0～1.0 (中央値が0)
+			return x >= 0 ? curve(x) : -curve(-x);
+		}
+
+		static bool isUsedSource(uint16_t src) {
+			return (src & 0x80) != 0 || (src & 0x7f) != 0;		// 0:No Controller (1.0として扱う)
+		}
+
+	public:
+		ModulatorProgramT() {}
+		ModulatorProgramT(const Soundfont::ModulatorList& mods) {
+			// チャンネル側(MidiModule)で GM2 の推奨式により処理済のデフォルトモジュレータ(ベロシティ,CC7,CC10,CC11,ピッチホイール)
+			static const auto isChannelProcessed = [](const Parse::SFMod& m) {
+				constexpr std::array<size_t, 5> indexes = { 0, 4, 5, 6, 9 };
+				const auto& defaults = Soundfont::getDefaultModulators();
+				return std::any_of(indexes.begin(), indexes.end(), [&](size_t i) { return defaults[i].isIdentical(m); });
+			};
+			for (const auto& m : mods) {
+				if (m.modAmount == 0 || isChannelProcessed(m)) continue;
+				if ((static_cast<uint16_t>(m.destOper) & 0x8000) != 0) continue;		// リンク(モジュレータの出力を入力元とする)は未対応
+				if ((m.srcOper & 0xff) == 127 || (m.amtSrcOper & 0xff) == 127) continue;
+				Op op{ m.srcOper, m.amtSrcOper, static_cast<T>(m.modAmount), m.modTransOper == 2 };
+				switch (m.destOper) {
+				case GenOperator::initialAttenuation:	op.dest = Dest::initialAttenuation;	m_gain = true; break;
+				case GenOperator::pan:					op.dest = Dest::pan;				m_gain = true; break;
+				case GenOperator::fineTune:				op.dest = Dest::fineTune;			m_pitch = true; break;
+				case GenOperator::coarseTune:			op.dest = Dest::coarseTune;			m_pitch = true; break;
+				case GenOperator::reverbEffectsSend:	op.dest = Dest::reverbEffectsSend;	break;
+				case GenOperator::chorusEffectsSend:	op.dest = Dest::chorusEffectsSend;	break;
+				default:	continue;		// 反映先が未実装(フィルタ,LFO等)
+				}
+				for (const auto src : { m.srcOper, m.amtSrcOper }) {
+					if (!isUsedSource(src)) continue;
+					if (src & 0x80) {
+						m_ccs.set(src & 0x7f);
+					} else if ((src & 0x7f) == 13) {
+						m_sources.set(static_cast<size_t>(ModulatorSources::Type::channelPressure));
+					} else if ((src & 0x7f) == 14) {
+						m_sources.set(static_cast<size_t>(ModulatorSources::Type::pitchWheel));
+					} else if ((src & 0x7f) == 16) {
+						m_sources.set(static_cast<size_t>(ModulatorSources::Type::pitchWheelSensitivity));
+					}
+				}
+				m_ops.push_back(op);
+			}
+		}
+
+		bool empty()const { return m_ops.empty(); }
+		bool isGainAffected()const { return m_gain; }
+		bool isPitchAffected()const { return m_pitch; }
+
+		// 入力元の変化で再評価が必要か
+		bool isDependent(ModulatorSources::Type type, uint8_t cc = 0)const {
+			if (type == ModulatorSources::Type::cc) return m_ccs.test(cc & 0x7f);
+			return m_sources.test(static_cast<size_t>(type));
+		}
+
+		ModulatorResult<T> evaluate(const ModulatorSources& sources, uint8_t key, uint8_t velocity)const {
+			ModulatorResult<T> result;
+			for (const auto& op : m_ops) {
+				T n = op.amount;
+				if (isUsedSource(op.src)) n *= getSource(op.src, sources, key, velocity);
+				if (isUsedSource(op.amtSrc)) n *= getSource(op.amtSrc, sources, key, velocity);
+				if (op.absolute) n = std::abs(n);
+				switch (op.dest) {
+				case Dest::initialAttenuation:	result.initialAttenuation += n;	break;
+				case Dest::pan:					result.pan += n;				break;
+				case Dest::fineTune:			result.pitch += n;				break;
+				case Dest::coarseTune:			result.pitch += n * 100;		break;
+				case Dest::reverbEffectsSend:	result.reverbEffectsSend += n;	break;
+				case Dest::chorusEffectsSend:	result.chorusEffectsSend += n;	break;
+				}
+			}
+			return result;
+		}
+	};
+
+	using ModulatorProgramF = ModulatorProgramT<float>;
+	using ModulatorProgram = ModulatorProgramT<double>;
+}
@@ -1,6 +1,10 @@
 ﻿#pragma once
 
+#include <mutex>
+#include <optional>
+
 #include "Soundfont.h"
+#include "SoundfontModulator.h"
 #include "MidiModule.h"
 
 namespace rlib::soundfont {
@@ -21,7 +25,7 @@ namespace rlib::soundfont {
 
 		// 事前処理済の中間情報
 		struct InterInfo {
-			std::reference_wrapper<const std::vector<T>> sample;			// 浮動小数点数に変換後の波形データ
+			std::reference_wrapper<const std::vector<T>> sample;			// 浮動小数点数に変換後の波形データ(ステレオなら L,R を交互に並べた波形データ)
 			midi::Envelope<T>	envelope;
 
 			uint16_t			rootKey;
@@ -29,28 +33,64 @@ namespace rlib::soundfont {
 			int16_t				coarseTune;
 			int16_t				scaleTuning;
 			int16_t				fineTune;
+			T					initialAttenuation;					// initialAttenuation (dB)
 			T					initialAttenuationAmplitude;		// initialAttenuation を振幅値(0～1.0)にした値
+			T					panValue;							// pan の値 -50(L) ～ 50(R)
 			std::pair<T, T>		pan;								// pan の値から L,R の倍率の値
+			uint16_t			exclusiveClass;						// 排他クラス(0:なし)
+			bool				stereo;								// ステレオ(リンクされた左右の波形)か
+			T					panRightValue;						// ステレオの場合の右の波形の pan の値
+			std::pair<T, T>		panRight;							// ステレオの場合の右の波形の pan の値から L,R の倍率の値
+			T					reverbEffectsSend;					// リバーブへの送り量 (%)
+			T					chorusEffectsSend;					// コーラスへの送り量 (%)
+			ModulatorProgramT<T>	modulator;						// モジュレータ(デフォルト + インストルメント + プリセット)
 		};
 
+		// pan の値 -50(L) ～ 50(R) から L,R の倍率の値
+		static std::pair<T, T> getPanGain(T n) {
+			constexpr std::pair<T, T> minmax{ static_cast<T>(-50.0),static_cast<T>(50.0) };
+			const T m = (std::min)(minmax.second, (std::max)(minmax.first, n));
+			const T normalized = (m - minmax.first) / (minmax.second - minmax.first);	// 0.0～1.0の範囲に変換
+			constexpr T pi2 = static_cast<T>(3.14159265358979323846 / 2.0);
+			const T l = std::sin((static_cast<T>(1.0) - normalized) * pi2);		// left 0.0～1.0
+			const T r = std::sin(normalized * pi2);								// right 0.0～1.0
+			return std::pair(l, r);
+		}
+
+		// 中間情報取得 (ゾーン毎に初回のみ生成。生成済なら排他制御無しで参照する)
 		const InterInfo& getInterInfo(const typename Soundfont::InstrumentRefer& refer) {
-			std::lock_guard<std::recursive_mutex> lock(m_interInfos.mutex);
-			if (const auto it = m_interInfos.mapInterInfo.find(refer); it != m_interInfos.mapInterInfo.end()) {
-				return it->second;
-			}
+			auto& slot = m_interInfos[refer.instrumentSample.get().index];
+			std::call_once(slot.once, [&] {
+				slot.value.emplace(createInterInfo(refer));
+			});
+			return *slot.value;
+		}
 
-			// 中間情報生成
+		// 浮動小数点数に変換後の波形データ取得 (波形毎に初回のみ生成。ステレオは左の波形の番号で別管理)
+		const std::vector<T>& getSample(const typename Soundfont::InstrumentSample& instrumentSample) {
+			const bool stereo = instrumentSample.spSampleRight != nullptr;
+			auto& slot = m_samples[instrumentSample.spSample->index * 2 + (stereo ? 1 : 0)];
+			std::call_once(slot.once, [&] {
+				slot.value.emplace(stereo ?
+					instrumentSample.spSample->createSample<T>(*m_soundfont, *instrumentSample.spSampleRight) :
+					instrumentSample.spSample->createSample<T>(*m_soundfont));
+			});
+			return *slot.value;
+		}
+
+		// 中間情報生成
+		InterInfo createInterInfo(const typename Soundfont::InstrumentRefer& refer) {
 			const typename Soundfont::Preset& preset = refer.preset;
 			const typename Soundfont::InstrumentSample& instrumentSample = refer.instrumentSample;
 			const typename Soundfont::Instrument& instrument = refer.instrument;
 
-			auto& sample = m_interInfos.mapSample[&*instrumentSample.spSample];
-			if (sample.empty()) {	// 浮動小数点数に変換後の波形データ
-				sample = std::move(instrumentSample.spSample->createSample<T>(*m_soundfont));
-			}
+			const auto& sample = getSample(instrumentSample);
 
+			const auto getAmountLocal = [&](GenOperator ope, const GeneratorMap& genInstLocal) {
+				return Soundfont::getGenAmount<T>(ope, genInstLocal, *instrument.genInstGlobal, *instrument.genPresetLocal, *preset.genPresetGlobal);
+			};
 			const auto getAmount = [&](GenOperator ope) {
-				return Soundfont::getGenAmount<T>(ope, *instrumentSample.genInstLocal, *instrument.genInstGlobal, *instrument.genPresetLocal, *preset.genPresetGlobal);
+				return getAmountLocal(ope, *instrumentSample.genInstLocal);
 			};
 
 			typename midi::Envelope<T>::Params params;
@@ -77,23 +117,105 @@ namespace rlib::soundfont {
 			i.scaleTuning = std::get<int16_t>(getAmount(GenOperator::scaleTuning));
 			i.fineTune = std::get<int16_t>(getAmount(GenOperator::fineTune));
 
-			i.initialAttenuationAmplitude = [&] {
-				const auto initialAttenuation = std::get<T>(getAmount(GenOperator::initialAttenuation));
-				return math::decibelsToAmplitude(-initialAttenuation);		// dB値から振幅値(0～1.0)へ
-			}();
-			i.pan = [&] {
-				const T n = std::get<T>(getAmount(GenOperator::pan));		// -50(L) ～ 50(R)
-				constexpr std::pair<T, T> minmax{ static_cast<T>(-50.0),static_cast<T>(50.0) };
-				const T m = (std::min)(minmax.second, (std::max)(minmax.first, n));
-				const T normalized = (m - minmax.first) / (minmax.second - minmax.first);	// 0.0～1.0の範囲に変換
-				constexpr T pi2 = static_cast<T>(3.14159265358979323846 / 2.0);
-				const T l = std::sin((static_cast<T>(1.0) - normalized) * pi2);		// left 0.0～1.0
-				const T r = std::sin(normalized * pi2);								// right 0.0～1.0
-				return std::pair(l, r);
+			i.initialAttenuation = std::get<T>(getAmount(GenOperator::initialAttenuation));
+			i.initialAttenuationAmplitude = math::decibelsToAmplitude(-i.initialAttenuation);		// dB値から振幅値(0～1.0)へ
+			i.panValue = std::get<T>(getAmount(GenOperator::pan));
+			i.pan = getPanGain(i.panValue);
+			i.stereo = instrumentSample.spSampleRight != nullptr;
+			i.panRightValue = i.stereo ? std::get<T>(getAmountLocal(GenOperator::pan, *instrumentSample.genInstLocalRight)) : 0;
+			i.panRight = i.stereo ? getPanGain(i.panRightValue) : std::pair<T, T>{};
+			i.exclusiveClass = [&]()->uint16_t {
+				auto r = getAmount(GenOperator::exclusiveClass);
+				auto p = std::get_if<int16_t>(&r);
+				return p ? *p : 0;
 			}();
+			i.reverbEffectsSend = std::get<T>(getAmount(GenOperator::reverbEffectsSend));
+			i.chorusEffectsSend = std::get<T>(getAmount(GenOperator::chorusEffectsSend));
+			i.modulator = ModulatorProgramT<T>(Soundfont::getModulators(*instrumentSample.modInstLocal, *instrument.modInstGlobal, *instrument.modPresetLocal, *preset.modPresetGlobal));
 
-			const auto it = m_interInfos.mapInterInfo.emplace(refer, std::move(i));
-			return it.first->second;
+			return i;
+		}
+
+		// ノート(キー)毎の中間情報
+		struct Inter {
+			std::reference_wrapper<const InterInfo>	interInfo;
+			double									advanceBase;	// 1サンプルあたりに、サンプルデータを読み進める土台の値
+			double									advanceNormal;	// 1サンプルあたりに、サンプルデータを読み進める値(pitchが0の場合)
+		};
+		Inter makeInter(const typename Soundfont::InstrumentRefer& refer, const typename Soundfont::PresetKey& presetKey) {
+			auto& i = getInterInfo(refer);
+
+			const typename Soundfont::InstrumentSample& instrumentSample = refer.instrumentSample;
+
+			// advanceBase advanceNormal
+			auto n = static_cast<double>(presetKey.note - (i.rootKey - i.coarseTune));	// オリジナルキーとの差(半音=1)
+			if (instrumentSample.spSample->pitchCorrection != 0) n += instrumentSample.spSample->pitchCorrection * 0.01;	// pitchCorrection/100
+			if (i.scaleTuning != 100) n *= i.scaleTuning * 0.01;	// scaleTuning/100
+			if (i.fineTune != 0) n += i.fineTune * 0.01;			// fineTune/100
+			double advanceBase = n;
+			double advanceNormal = getAdvance(advanceBase, 0.0, instrumentSample.spSample->sampleRate, m_sampleRate);
+
+			return Inter{ i, advanceBase, advanceNormal };
+		}
+
+		// ループ再生するか
+		static bool isLoop(const InterInfo& interInfo, const typename Soundfont::SampleBody& sampleBody) {
+			if (interInfo.sampleModes == enumSampleMode::loop || interInfo.sampleModes == enumSampleMode::keyloop) {	// ループあり
+				if (sampleBody.loop.second - sampleBody.loop.first >= 32) {		// ループ範囲が32サンプル以上のみ有効
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// 排他クラスで消音させるか (同一プリセットの同一排他クラス)
+		static bool isExclusive(const typename Soundfont::InstrumentRefer& refer, const InterInfo& interInfo, const typename Soundfont::Preset* preset, uint16_t exclusiveClass) {
+			return exclusiveClass != 0 && interInfo.exclusiveClass == exclusiveClass && &refer.preset.get() == preset;
+		}
+
+		// 振幅値(sampleに掛ける値) l,r  (ステレオの場合は左の波形に掛ける値)
+		static std::pair<T, T> getAmplitude(const InterInfo& interInfo, uint8_t velocity) {
+			return getAmplitude(interInfo, velocity, interInfo.pan);
+		}
+		static std::pair<T, T> getAmplitude(const InterInfo& interInfo, uint8_t velocity, const std::pair<T, T>& pan) {
+			return getAmplitude(interInfo.initialAttenuationAmplitude, velocity, pan);
+		}
+		static std::pair<T, T> getAmplitude(T initialAttenuationAmplitude, uint8_t velocity, const std::pair<T, T>& pan) {
+			T a = initialAttenuationAmplitude;				// generator.initialAttenuation 反映
+			a *= midi::volumeGainTable<T>[velocity];		// ベロシティ (ベロシティには推奨式が定義されてないがvolumeの推奨式と同等とする)
+			return { a * pan.first, a * pan.second };
+		}
+
+		// モジュレータを反映した値
+		struct Modulated {
+			std::pair<T, T>		amplitude;			// 振幅値 l,r (ステレオの場合は左の波形)
+			std::pair<T, T>		amplitudeRight;		// ステレオの場合の右の波形の振幅値 l,r
+			double				pitch = 0.0;		// 音程の変化量(半音単位)
+			T					reverbSend = 0;		// リバーブへの送り量 0.0～1.0
+			T					chorusSend = 0;		// コーラスへの送り量 0.0～1.0
+			ModulatorResult<T>	result;
+		};
+		static Modulated modulate(const InterInfo& interInfo, uint8_t key, uint8_t velocity, const ModulatorSources* sources) {
+			Modulated m;
+			if (sources && !interInfo.modulator.empty()) {
+				m.result = interInfo.modulator.evaluate(*sources, key, velocity);
+			}
+			if (interInfo.modulator.isGainAffected()) {
+				const T attenuation = std::clamp(interInfo.initialAttenuation + m.result.initialAttenuation / 10, static_cast<T>(0.0), static_cast<T>(144.0));	// cB → dB
+				const T attenuationAmplitude = math::decibelsToAmplitude(-attenuation);
+				m.amplitude = getAmplitude(attenuationAmplitude, velocity, getPanGain(interInfo.panValue + m.result.pan / 10));		// 0.1% → %
+				m.amplitudeRight = getAmplitude(attenuationAmplitude, velocity, getPanGain(interInfo.panRightValue + m.result.pan / 10));
+			} else {
+				m.amplitude = getAmplitude(interInfo, velocity);
+				m.amplitudeRight = getAmplitude(interInfo, velocity, interInfo.panRight);
+			}
+			m.pitch = m.result.pitch / 100;		// cent → 半音
+			const auto getSend = [](T generator, T modulator) {		// % + 0.1% → 0.0～1.0
+				return std::clamp((generator + modulator / 10) / 100, static_cast<T>(0.0), static_cast<T>(1.0));
+			};
+			m.reverbSend = getSend(interInfo.reverbEffectsSend, m.result.reverbEffectsSend);
+			m.chorusSend = getSend(interInfo.chorusEffectsSend, m.result.chorusEffectsSend);
+			return m;
 		}
 
 	private:
@@ -105,17 +227,14 @@ namespace rlib::soundfont {
 			struct Keyoff {
 				size_t	position;		// キーオフされた位置
 				T		amplitude;		// キーオフされたときの音量(0.0～1.0)
+				const midi::Envelope<T>* envelope;	// リリースに使用するエンベロープ
 			};
 			std::optional<Keyoff>	m_keyoff;		// キーオフ
 
 		public:
 			const typename Soundfont::InstrumentRefer	m_instrumentRefer;
-			struct Inter {
-				std::reference_wrapper<const InterInfo>	interInfo;
-				double									advanceBase;	// 1サンプルあたりに、サンプルデータを読み進める土台の値
-				double									advanceNormal;	// 1サンプルあたりに、サンプルデータを読み進める値(pitchが0の場合)
-			};
 			std::optional<Inter> m_inter;
+			std::optional<Modulated> m_modulated;	// モジュレータ反映値
 
 			Instrument(const typename Soundfont::InstrumentRefer& instrumentRefer)
 				:m_instrumentRefer(instrumentRefer)
@@ -126,24 +245,20 @@ namespace rlib::soundfont {
 
 			const Inter& ensureInter(const Note& note) {
 				if (!m_inter){
-					auto& renderer = note.m_renderer;
-					auto& i = note.m_renderer.getInterInfo(m_instrumentRefer);
-
-					const typename Soundfont::InstrumentSample& instrumentSample = m_instrumentRefer.instrumentSample;
-
-					// advanceBase advanceNormal
-					auto n = static_cast<double>(note.m_presetKey.note - (i.rootKey - i.coarseTune));	// オリジナルキーとの差(半音=1)
-					if (instrumentSample.spSample->pitchCorrection != 0) n += instrumentSample.spSample->pitchCorrection * 0.01;	// pitchCorrection/100
-					if (i.scaleTuning != 100) n *= i.scaleTuning * 0.01;	// scaleTuning/100
-					if (i.fineTune != 0) n += i.fineTune * 0.01;			// fineTune/100
-					double advanceBase = n;
-					double advanceNormal = getAdvance(advanceBase, 0.0, instrumentSample.spSample->sampleRate, renderer.m_sampleRate);
-
-					m_inter = Inter{ i, advanceBase, advanceNormal };
+					m_inter = note.m_renderer.makeInter(m_instrumentRefer, note.m_presetKey);
 				}
 				return *m_inter;
 			}
 
+			// モジュレータ評価 (sources が nullptr ならモジュレータの入力元なし)
+			const Modulated& modulate(const Note& note, const ModulatorSources* sources) {
+				m_modulated = RendererT::modulate(ensureInter(note).interInfo, note.m_presetKey.note, note.m_presetKey.velocity, sources);
+				return *m_modulated;
+			}
+			const Modulated& ensureModulated(const Note& note) {
+				return m_modulated ? *m_modulated : modulate(note, nullptr);
+			}
+
 			void keyoff(const Note& note) {
 				auto& inter = ensureInter(note);
 				if (m_keyoff) return;		// 既にkeyoff済みなら無視する(正常系でもあり得る)
@@ -151,29 +266,55 @@ namespace rlib::soundfont {
 				Keyoff k;
 				k.position = m_renderedSize;
 				k.amplitude = gains[0];
+				k.envelope = &inter.interInfo.get().envelope;
 				m_keyoff = k;
 			}
 
+			// 排他クラスによる消音 (現在の音量から短いリリースで終了させる)
+			void choke(const Note& note) {
+				auto& inter = ensureInter(note);
+				const auto& chokeEnvelope = note.m_renderer.m_exclusiveClassEnvelope;
+				T amplitude = 0;
+				if (m_keyoff) {
+					if (m_keyoff->envelope == &chokeEnvelope) return;		// 既に消音中
+					const size_t position = m_renderedSize - m_keyoff->position;
+					if (position >= m_keyoff->envelope->m_params.releaseVolEnv) return;	// リリース完了済
+					m_keyoff->envelope->getGainsReleaseRate(position, &amplitude, 1);
+					amplitude *= m_keyoff->amplitude;
+				} else {
+					inter.interInfo.get().envelope.getGains(m_renderedSize, &amplitude, 1);
+				}
+				m_keyoff = Keyoff{ m_renderedSize, amplitude, &chokeEnvelope };
+			}
+
 			auto render(const Note& note, size_t size, double pitch = 0.0) {
 				auto& inter = ensureInter(note);
 
 				struct Result {	// 戻り値
-					std::vector<T> samples;	// 配列数が引数size未満の場合は出力完了の意味
+					std::vector<T> samples;			// 配列数が引数size未満の場合は出力完了の意味 (ステレオなら左の波形)
+					std::vector<T> samplesRight;	// ステレオの場合の右の波形(モノラルなら空)
 					struct {
 						T l, r;
-					}amplitude;
+					}amplitude, amplitudeRight;
+					T reverbSend;		// リバーブへの送り量 0.0～1.0
+					T chorusSend;		// コーラスへの送り量 0.0～1.0
 				}result;
-				result.samples.resize(size);
 				const typename Soundfont::SampleBody& sampleBody = *(m_instrumentRefer.instrumentSample.get().spSample);
 				const InterInfo& interInfo = inter.interInfo;
+				result.samples.resize(size);
+				if (interInfo.stereo) result.samplesRight.resize(size);
 
+				const auto& modulated = ensureModulated(note);
 				{// 振幅値(sampleに掛ける値)
-					T a = interInfo.initialAttenuationAmplitude;	// generator.initialAttenuation 反映
-					a *= midi::volumeGainTable<T>[note.m_presetKey.velocity];	// ベロシティ (ベロシティには推奨式が定義されてないがvolumeの推奨式と同等とする)
-					result.amplitude.l = a * interInfo.pan.first;
-					result.amplitude.r = a * interInfo.pan.second;
+					result.amplitude.l = modulated.amplitude.first;
+					result.amplitude.r = modulated.amplitude.second;
+					result.amplitudeRight.l = modulated.amplitudeRight.first;
+					result.amplitudeRight.r = modulated.amplitudeRight.second;
 				}
+				result.reverbSend = modulated.reverbSend;
+				result.chorusSend = modulated.chorusSend;
 
+				pitch += modulated.pitch;
 				const double multiply = [&] {				// 乗値(=1サンプルあたり進む値)
 					if (pitch == 0.0) {
 						return inter.advanceNormal;
@@ -184,11 +325,13 @@ namespace rlib::soundfont {
 
 				// エンベロープ値(0.0～1.0) 配列がsize未満なら終了の意味
 				const std::vector<T> env = m_keyoff ?
-					interInfo.envelope.getGainsReleaseRate(m_renderedSize - m_keyoff->position, size) :
+					m_keyoff->envelope->getGainsReleaseRate(m_renderedSize - m_keyoff->position, size) :
 					interInfo.envelope.getGains(m_renderedSize, size);
 				if (m_keyoff) {
 					result.amplitude.l *= m_keyoff->amplitude;
 					result.amplitude.r *= m_keyoff->amplitude;
+					result.amplitudeRight.l *= m_keyoff->amplitude;
+					result.amplitudeRight.r *= m_keyoff->amplitude;
 				}
 
 #if 0
@@ -203,48 +346,45 @@ namespace rlib::soundfont {
 				}
 #endif
 
-				const auto isLoop = [&] {
-					if (interInfo.sampleModes == enumSampleMode::loop || interInfo.sampleModes == enumSampleMode::keyloop) {	// ループあり
-						if (sampleBody.loop.second - sampleBody.loop.first >= 32) {		// ループ範囲が32サンプル以上のみ有効
-							return true;
-						}
-					}
-					return false;
-				}();
+				const bool isLoop = RendererT::isLoop(interInfo, sampleBody);
 
 				auto &smpl = interInfo.sample.get();
+				const size_t channels = interInfo.stereo ? 2 : 1;		// ステレオは L,R を交互に並べた波形データ
+				const size_t frames = smpl.size() / channels;
 				size_t i = 0;
 				for (; i < env.size(); i++) {
 
 					const auto posf = m_currentPosition;
 					size_t pos = static_cast<size_t>(posf);
-					if (!isLoop && pos >= smpl.size()) break;		// 最後までいったら抜ける
-
-					T sample = [&] {
-						const T decimal = static_cast<T>(posf - pos);	// 小数部
-						T a, b;
-						if (isLoop) {
-							if (pos > sampleBody.loop.second) {
-								pos = sampleBody.loop.first + (pos - sampleBody.loop.first) % (sampleBody.loop.second - sampleBody.loop.first);
-							}
-							a = smpl[pos];
-							b = smpl[pos == sampleBody.loop.second ? sampleBody.loop.first : pos + 1];
-						} else {						// ループなし
-							a = smpl[pos];					// 範囲チェックは不要(上でやってる)
-							b = pos + 1 < smpl.size() ? smpl[pos + 1] : 0;
+					if (!isLoop && pos >= frames) break;		// 最後までいったら抜ける
+
+					const T decimal = static_cast<T>(posf - pos);	// 小数部
+					size_t next;
+					if (isLoop) {
+						if (pos > sampleBody.loop.second) {
+							pos = sampleBody.loop.first + (pos - sampleBody.loop.first) % (sampleBody.loop.second - sampleBody.loop.first);
 						}
+						next = pos == sampleBody.loop.second ? sampleBody.loop.first : pos + 1;
+					} else {						// ループなし
+						next = pos + 1;				// 範囲チェックは下で行う
+					}
+					const auto interpolate = [&](size_t channel) {
+						const T a = smpl[pos * channels + channel];
+						const T b = isLoop || next < frames ? smpl[next * channels + channel] : 0;
 						return a + ((b - a) * decimal);
-					}();
-
-					sample *= env[i];		// エンベロープ
+					};
 
-					result.samples[i] = sample;
+					result.samples[i] = interpolate(0) * env[i];		// エンベロープ
+					if (channels == 2) {
+						result.samplesRight[i] = interpolate(1) * env[i];
+					}
 
 					m_currentPosition += multiply;
 				}
 
 				if (i < size) {		// size未満で抜けてきたら完了
 					result.samples.resize(i);
+					if (channels == 2) result.samplesRight.resize(i);
 				}
 
 				m_renderedSize += result.samples.size();
@@ -254,25 +394,36 @@ namespace rlib::soundfont {
 		};
 
 	private:
-		struct LessInstrumentRefer {
-			template<typename U> bool operator()(const U& a, const U& b)const { return &a.instrumentSample.get() < &b.instrumentSample.get(); }
+		// 初回参照時に生成する値 (生成後は変更しないので参照に排他制御は不要)
+		template <typename V> struct Slot {
+			std::once_flag		once;
+			std::optional<V>	value;
 		};
-		struct {
-			std::map<const typename Soundfont::SampleBody*, std::vector<T>>	mapSample;	// 浮動小数点数波形データ実体
-			std::map<typename Soundfont::InstrumentRefer, InterInfo, LessInstrumentRefer>		mapInterInfo;
-			std::recursive_mutex												mutex;
-		}m_interInfos;
+		std::unique_ptr<Slot<InterInfo>[]>		m_interInfos;	// 中間情報 [ゾーンの通し番号]
+		std::unique_ptr<Slot<std::vector<T>>[]>	m_samples;		// 浮動小数点数波形データ実体 [波形の通し番号 * 2 + ステレオか]
 	public:
 		const std::shared_ptr<const Soundfont> m_soundfont;
 		const uint32_t	m_sampleRate;
+		const midi::Envelope<T>	m_exclusiveClassEnvelope;	// 排他クラスで消音する際のリリース用エンベロープ
+
+		static constexpr double exclusiveClassReleaseTime = 0.01;	// 排他クラスで消音する際のリリース時間(秒)
 
 		RendererT(std::shared_ptr<const Soundfont>& sp, uint32_t sampleRate)
-			:m_soundfont(sp)
+			:m_interInfos(std::make_unique<Slot<InterInfo>[]>(sp->getZoneCount()))
+			, m_samples(std::make_unique<Slot<std::vector<T>>[]>(sp->getSampleCount() * 2))
+			, m_soundfont(sp)
 			, m_sampleRate(sampleRate)
+			, m_exclusiveClassEnvelope({ 0, 0, 0, 0, static_cast<T>(1.0), static_cast<size_t>(sampleRate * exclusiveClassReleaseTime) })
 		{}
 		RendererT(const RendererT&) = delete;
 		RendererT& operator=(const RendererT&) = delete;
 
+		// エフェクト(リバーブ,コーラス)への送りバス (送りが無ければ空)
+		struct Sends {
+			std::vector<midi::StereoSample<T>>	reverb;
+			std::vector<midi::StereoSample<T>>	chorus;
+		};
+
 		class Note {
 			friend class RendererT;
 		public:
@@ -293,7 +444,8 @@ namespace rlib::soundfont {
 			Note& operator=(const Note&) = delete;
 
 			// レンダリング(波形データ出力（結果配列がsize未満なら完了）
-			std::vector<midi::StereoSample<T>> render(size_t size, double pitch = 0.0) {
+			// sends を指定すると、エフェクトへの送りを加算する(送りのあるエフェクトのバスは size 要素に拡張)
+			std::vector<midi::StereoSample<T>> render(size_t size, double pitch = 0.0, Sends* sends = nullptr) {
 				std::vector<midi::StereoSample<T>> result(size);
 
 				size_t resultSize = 0;
@@ -310,6 +462,26 @@ namespace rlib::soundfont {
 							result[i].r += rendered.samples[i] * rendered.amplitude.r;
 						}
 					}
+					for (size_t i = 0; i < rendered.samplesRight.size(); i++) {		// ステレオの右の波形
+						result[i].l += rendered.samplesRight[i] * rendered.amplitudeRight.l;
+						result[i].r += rendered.samplesRight[i] * rendered.amplitudeRight.r;
+					}
+					const auto send = [&](std::vector<midi::StereoSample<T>>& bus, T level) {		// エフェクトへの送り
+						if (level <= 0) return;
+						if (bus.empty()) bus.resize(size);
+						for (size_t i = 0; i < rendered.samples.size(); i++) {
+							bus[i].l += rendered.samples[i] * (rendered.amplitude.l * level);
+							bus[i].r += rendered.samples[i] * (rendered.amplitude.r * level);
+						}
+						for (size_t i = 0; i < rendered.samplesRight.size(); i++) {
+							bus[i].l += rendered.samplesRight[i] * (rendered.amplitudeRight.l * level);
+							bus[i].r += rendered.samplesRight[i] * (rendered.amplitudeRight.r * level);
+						}
+					};
+					if (sends) {
+						send(sends->reverb, rendered.reverbSend);
+						send(sends->chorus, rendered.chorusSend);
+					}
 					if (rendered.samples.size() < size) {	// 完了なら
 						it = m_instruments.erase(it);		// 破棄
 					} else {
@@ -328,19 +500,478 @@ namespace rlib::soundfont {
 				}
 			}
 
+			// モジュレータ評価 (ノートオン時)
+			void modulate(const ModulatorSources& sources) {
+				for (auto& inst : m_instruments) {
+					inst.modulate(*this, &sources);
+				}
+			}
+			// モジュレータ再評価 (入力元が変化した時。参照しているゾーンのみ)
+			void modulate(const ModulatorSources& sources, ModulatorSources::Type type, uint8_t cc = 0) {
+				for (auto& inst : m_instruments) {
+					if (inst.ensureInter(*this).interInfo.get().modulator.isDependent(type, cc)) {
+						inst.modulate(*this, &sources);
+					}
+				}
+			}
+
 			bool isFinished()const {
 				return m_instruments.empty();
 			}
+
+			// 排他クラス: newNote が発音するゾーンと同一プリセット・同一排他クラスのゾーンを消音
+			void chokeExclusive(Note& newNote) {
+				for (auto& newInst : newNote.m_instruments) {
+					const InterInfo& newInterInfo = newInst.ensureInter(newNote).interInfo;
+					if (newInterInfo.exclusiveClass == 0) continue;
+					for (auto& inst : m_instruments) {
+						if (isExclusive(inst.m_instrumentRefer, inst.ensureInter(*this).interInfo, &newInst.m_instrumentRefer.preset.get(), newInterInfo.exclusiveClass)) {
+							inst.choke(*this);
+						}
+					}
+				}
+			}
 		};
 
 		Note createNote(const typename Soundfont::PresetKey& presetKey) {
+			return createNote(m_soundfont->getPreset(presetKey), presetKey);
+		}
+
+		// 解決済のプリセットから生成 (プリセットの検索無し)
+		Note createNote(const typename Soundfont::Preset& preset, const typename Soundfont::PresetKey& presetKey) {
+			return createNote(Soundfont::getPreset(preset, presetKey), presetKey);
+		}
+	private:
+		Note createNote(const std::vector<typename Soundfont::InstrumentRefer>& refers, const typename Soundfont::PresetKey& presetKey) {
 			std::list<Instrument> instruments;
-			auto preset = m_soundfont->getPreset(presetKey);
-			for (auto& inst : preset) {
+			for (auto& inst : refers) {
 				instruments.emplace_back(inst);
 			}
 			return Note(*this, presetKey, std::move(instruments));
 		}
+	public:
+
+		// 全ボイス(ゾーン単位)を SoA(Structure of Arrays) で保持し、ブロック単位で一括レンダリングするエンジン
+		// Note と同じ中間情報(InterInfo)を用い、ボイス毎の一時配列を作らずチャンネル毎のバスへ直接加算する
+		class VoiceEngine {
+		public:
+			static constexpr size_t channelCount = 16;
+			using Bus = std::vector<midi::StereoSample<T>>;
+			struct Output {		// チャンネル毎の出力先
+				Bus		dry;
+				Bus		reverb;		// リバーブへの送り(送りが無ければ空)
+				Bus		chorus;		// コーラスへの送り(送りが無ければ空)
+			};
+		private:
+			static constexpr size_t notKeyoff = (std::numeric_limits<size_t>::max)();
+
+			RendererT& m_renderer;
+
+			struct Voices {
+				std::vector<uint8_t>					channel;		// 出力先バス(MIDIチャンネル 0～15)
+				std::vector<uint8_t>					key;			// ノートオンされたキー(ノートオフ判定用)
+				std::vector<const typename Soundfont::Preset*>	preset;	// プリセット(排他クラス判定用)
+				std::vector<uint16_t>					exclusiveClass;	// 排他クラス(0:なし)
+				std::vector<const InterInfo*>			interInfo;		// 中間情報(モジュレータ再評価用)
+				std::vector<uint8_t>					noteKey;		// 発音キー(モジュレータの入力元)
+				std::vector<uint8_t>					velocity;		// ベロシティ(モジュレータの入力元)
+				std::vector<const T*>					sample;			// 浮動小数点数に変換後の波形データ(ステレオなら L,R を交互に並べた波形データ)
+				std::vector<size_t>						sampleSize;		// 波形データのサンプル数(ステレオなら L,R の組の数)
+				std::vector<uint8_t>					stereo;			// ステレオ(リンクされた左右の波形)か
+				std::vector<uint32_t>					loopBegin;		// ループ開始位置
+				std::vector<uint32_t>					loopEnd;		// ループ終了位置
+				std::vector<uint8_t>					loop;			// ループ再生するか
+				std::vector<uint32_t>					sampleRate;		// 波形データのサンプルレート
+				std::vector<double>						position;		// 現在位置(サンプルデータ)
+				std::vector<double>						advanceBase;	// 1サンプルあたりに、サンプルデータを読み進める土台の値
+				std::vector<double>						advanceNormal;	// 1サンプルあたりに、サンプルデータを読み進める値(pitchが0の場合)
+				std::vector<double>						pitch;			// モジュレータによる音程の変化量(半音単位)
+				std::vector<const midi::Envelope<T>*>	envelope;		// エンベロープ
+				std::vector<size_t>						renderedSize;	// レンダリング済の出力サンプル数
+				std::vector<size_t>						keyoffPosition;	// キーオフされた位置(notKeyoff:キーオフ前)
+				std::vector<T>							keyoffAmplitude;	// キーオフされたときの音量(0.0～1.0 キーオフ前は1.0)
+				std::vector<T>							gainL;			// 振幅値 L
+				std::vector<T>							gainR;			// 振幅値 R
+				std::vector<T>							gainRightL;		// ステレオの右の波形の振幅値 L
+				std::vector<T>							gainRightR;		// ステレオの右の波形の振幅値 R
+				std::vector<T>							reverbSend;		// リバーブへの送り量 0.0～1.0
+				std::vector<T>							chorusSend;		// コーラスへの送り量 0.0～1.0
+
+				template <typename F> void forEach(F f) {
+					f(channel); f(key); f(preset); f(exclusiveClass); f(interInfo); f(noteKey); f(velocity); f(sample); f(sampleSize); f(stereo); f(loopBegin); f(loopEnd); f(loop); f(sampleRate);
+					f(position); f(advanceBase); f(advanceNormal); f(pitch); f(envelope); f(renderedSize); f(keyoffPosition); f(keyoffAmplitude); f(gainL); f(gainR); f(gainRightL); f(gainRightR); f(reverbSend); f(chorusSend);
+				}
+				size_t size()const { return channel.size(); }
+			}m_voices;
+
+			std::vector<T>			m_env;		// エンベロープ値の作業領域
+			std::vector<uint8_t>	m_finished;	// 完了フラグの作業領域
+
+			std::array<std::vector<uint32_t>, channelCount * 128>	m_keyVoices;	// (チャンネル,キー)毎のキーオフ前のボイス(ノートオフでの検索用)
+			std::array<std::vector<uint32_t>, channelCount>		m_channelVoices;	// チャンネル毎のボイス(モジュレータ再評価・排他クラスでの検索用)
+			size_t					m_maxVoices = 0;	// 最大ボイス数(0:無制限)
+
+			static constexpr size_t chunkVoices = 512;	// 並列にレンダリングする単位のボイス数 (ボイス数のみで分割するので結果はスレッド数に依らない)
+			struct Work {		// 2単位目以降の作業領域(単位毎)
+				std::array<Output, channelCount>	outputs;
+				std::array<size_t, channelCount>	lengths;
+				std::array<bool, channelCount>		cleared;
+				std::vector<T>						env;
+			};
+			std::vector<Work>		m_works;
+
+			static size_t keyIndex(uint8_t channel, uint8_t key) {
+				return (channel & 0xf) * 128 + (key & 0x7f);
+			}
+
+		public:
+			VoiceEngine(RendererT& renderer)
+				:m_renderer(renderer)
+			{}
+			VoiceEngine(const VoiceEngine&) = delete;
+			VoiceEngine& operator=(const VoiceEngine&) = delete;
+
+			// 最大ボイス数(0:無制限) 超えた分はレンダリング時にキーオフ済みの古いものから短いリリースで終了させる
+			void setMaxVoices(size_t maxVoices) {
+				m_maxVoices = maxVoices;
+			}
+
+			// ノートオン(戻り値は生成したボイス数)
+			size_t noteOn(uint8_t channel, uint8_t key, const typename Soundfont::PresetKey& presetKey, const ModulatorSources& sources) {
+				return noteOn(channel, key, presetKey, m_renderer.m_soundfont->getPreset(presetKey), sources);
+			}
+
+			// ノートオン 解決済のプリセットから生成 (プリセットの検索無し)
+			size_t noteOn(uint8_t channel, uint8_t key, const typename Soundfont::Preset& preset, const typename Soundfont::PresetKey& presetKey, const ModulatorSources& sources) {
+				return noteOn(channel, key, presetKey, Soundfont::getPreset(preset, presetKey), sources);
+			}
+		private:
+			size_t noteOn(uint8_t channel, uint8_t key, const typename Soundfont::PresetKey& presetKey, const std::vector<typename Soundfont::InstrumentRefer>& refers, const ModulatorSources& sources) {
+				for (const auto& refer : refers) {		// 排他クラス (追加前に消音するので同時に発音するゾーン同士は対象外)
+					const InterInfo& interInfo = m_renderer.getInterInfo(refer);
+					if (interInfo.exclusiveClass != 0) {
+						choke(channel, &refer.preset.get(), interInfo.exclusiveClass);
+					}
+				}
+
+				size_t count = 0;
+				for (const auto& refer : refers) {
+					const Inter inter = m_renderer.makeInter(refer, presetKey);
+					const InterInfo& interInfo = inter.interInfo;
+					const typename Soundfont::SampleBody& sampleBody = *refer.instrumentSample.get().spSample;
+					const auto modulated = RendererT::modulate(interInfo, presetKey.note, presetKey.velocity, &sources);
+
+					auto& v = m_voices;
+					v.channel.push_back(channel & 0xf);
+					v.key.push_back(key);
+					v.preset.push_back(&refer.preset.get());
+					v.exclusiveClass.push_back(interInfo.exclusiveClass);
+					v.interInfo.push_back(&interInfo);
+					v.noteKey.push_back(presetKey.note);
+					v.velocity.push_back(presetKey.velocity);
+					v.sample.push_back(interInfo.sample.get().data());
+					v.sampleSize.push_back(interInfo.sample.get().size() / (interInfo.stereo ? 2 : 1));
+					v.stereo.push_back(interInfo.stereo);
+					v.loopBegin.push_back(sampleBody.loop.first);
+					v.loopEnd.push_back(sampleBody.loop.second);
+					v.loop.push_back(isLoop(interInfo, sampleBody));
+					v.sampleRate.push_back(sampleBody.sampleRate);
+					v.position.push_back(0.0);
+					v.advanceBase.push_back(inter.advanceBase);
+					v.advanceNormal.push_back(inter.advanceNormal);
+					v.pitch.push_back(modulated.pitch);
+					v.envelope.push_back(&interInfo.envelope);
+					v.renderedSize.push_back(0);
+					v.keyoffPosition.push_back(notKeyoff);
+					v.keyoffAmplitude.push_back(1);
+					v.gainL.push_back(modulated.amplitude.first);
+					v.gainR.push_back(modulated.amplitude.second);
+					v.gainRightL.push_back(modulated.amplitudeRight.first);
+					v.gainRightR.push_back(modulated.amplitudeRight.second);
+					v.reverbSend.push_back(modulated.reverbSend);
+					v.chorusSend.push_back(modulated.chorusSend);
+					m_keyVoices[keyIndex(channel, key)].push_back(static_cast<uint32_t>(v.size() - 1));
+					m_channelVoices[channel & 0xf].push_back(static_cast<uint32_t>(v.size() - 1));
+					count++;
+				}
+				return count;
+			}
+		public:
+
+			// ノートオフ
+			void noteOff(uint8_t channel, uint8_t key) {
+				auto& v = m_voices;
+				auto& voices = m_keyVoices[keyIndex(channel, key)];
+				for (const size_t i : voices) {
+					if (v.keyoffPosition[i] != notKeyoff) continue;		// 既にkeyoff済み(排他クラスによる消音)なら無視する
+					T amplitude;
+					v.envelope[i]->getGains(v.renderedSize[i], &amplitude, 1);	// 現在のエンベロープ値
+					v.keyoffAmplitude[i] *= amplitude;
+					v.keyoffPosition[i] = v.renderedSize[i];
+				}
+				voices.clear();
+			}
+
+			// モジュレータ再評価 (入力元が変化した時。参照しているボイスのみ)
+			void modulate(uint8_t channel, const ModulatorSources& sources, ModulatorSources::Type type, uint8_t cc = 0) {
+				auto& v = m_voices;
+				for (const size_t i : m_channelVoices[channel & 0xf]) {
+					if (!v.interInfo[i]->modulator.isDependent(type, cc)) continue;
+					const auto modulated = RendererT::modulate(*v.interInfo[i], v.noteKey[i], v.velocity[i], &sources);
+					v.pitch[i] = modulated.pitch;
+					v.gainL[i] = modulated.amplitude.first;
+					v.gainR[i] = modulated.amplitude.second;
+					v.gainRightL[i] = modulated.amplitudeRight.first;
+					v.gainRightR[i] = modulated.amplitudeRight.second;
+					v.reverbSend[i] = modulated.reverbSend;
+					v.chorusSend[i] = modulated.chorusSend;
+				}
+			}
+
+			// 排他クラスによる消音 (現在の音量から短いリリースで終了させる)
+			void choke(uint8_t channel, const typename Soundfont::Preset* preset, uint16_t exclusiveClass) {
+				auto& v = m_voices;
+				for (const size_t i : m_channelVoices[channel & 0xf]) {
+					if (v.exclusiveClass[i] != exclusiveClass || v.preset[i] != preset) continue;
+					quickRelease(i);
+				}
+			}
+		private:
+			// 現在の音量から m_exclusiveClassEnvelope の短いリリースで終了させる (戻り値は終了させたか。既に消音中・リリース完了済なら false)
+			bool quickRelease(size_t i) {
+				auto& v = m_voices;
+				const auto* chokeEnvelope = &m_renderer.m_exclusiveClassEnvelope;
+				if (v.envelope[i] == chokeEnvelope) return false;		// 既に消音中
+				T amplitude = 0;
+				if (v.keyoffPosition[i] != notKeyoff) {
+					const size_t position = v.renderedSize[i] - v.keyoffPosition[i];
+					if (position >= v.envelope[i]->m_params.releaseVolEnv) return false;	// リリース完了済
+					v.envelope[i]->getGainsReleaseRate(position, &amplitude, 1);
+				} else {
+					v.envelope[i]->getGains(v.renderedSize[i], &amplitude, 1);
+				}
+				v.keyoffAmplitude[i] *= amplitude;
+				v.envelope[i] = chokeEnvelope;
+				v.keyoffPosition[i] = v.renderedSize[i];
+				return true;
+			}
+		public:
+
+			// 1ボイス分をバスへ加算 (戻り値は出力サンプル数)
+			template <bool Loop, bool Stereo, bool Send> static size_t renderVoice(const Voices& v, size_t n, double& posf, double multiply, const T* const env, size_t envSize, Output& output) {
+				midi::StereoSample<T>* const out = output.dry.data();
+				midi::StereoSample<T>* const reverb = output.reverb.data();
+				midi::StereoSample<T>* const chorus = output.chorus.data();
+				constexpr size_t channels = Stereo ? 2 : 1;		// ステレオは L,R を交互に並べた波形データ
+				const T* const smpl = v.sample[n];
+				const size_t smplSize = v.sampleSize[n];
+				const size_t loopBegin = v.loopBegin[n];
+				const size_t loopEnd = v.loopEnd[n];
+				const T gainL = v.gainL[n] * v.keyoffAmplitude[n];
+				const T gainR = v.gainR[n] * v.keyoffAmplitude[n];
+				const T gainRightL = v.gainRightL[n] * v.keyoffAmplitude[n];
+				const T gainRightR = v.gainRightR[n] * v.keyoffAmplitude[n];
+				const T reverbSend = v.reverbSend[n];
+				const T chorusSend = v.chorusSend[n];
+				size_t i = 0;
+				for (; i < envSize; i++) {
+					size_t pos = static_cast<size_t>(posf);
+					if constexpr (!Loop) {
+						if (pos >= smplSize) break;		// 最後までいったら抜ける
+					}
+					const T decimal = static_cast<T>(posf - pos);	// 小数部
+					size_t next;
+					if constexpr (Loop) {
+						if (pos > loopEnd) {
+							pos = loopBegin + (pos - loopBegin) % (loopEnd - loopBegin);
+						}
+						next = pos == loopEnd ? loopBegin : pos + 1;
+					} else {
+						next = pos + 1;
+					}
+					const auto interpolate = [&](size_t channel) {
+						const T a = smpl[pos * channels + channel];
+						const T b = Loop || next < smplSize ? smpl[next * channels + channel] : 0;
+						return (a + ((b - a) * decimal)) * env[i];
+					};
+					const T sample = interpolate(0);
+					midi::StereoSample<T> s;
+					if constexpr (Stereo) {
+						const T sampleRight = interpolate(1);
+						s = { sample * gainL + sampleRight * gainRightL, sample * gainR + sampleRight * gainRightR };
+					} else {
+						s = { sample * gainL, sample * gainR };
+					}
+					out[i].l += s.l;
+					out[i].r += s.r;
+					if constexpr (Send) {
+						reverb[i].l += s.l * reverbSend;
+						reverb[i].r += s.r * reverbSend;
+						chorus[i].l += s.l * chorusSend;
+						chorus[i].r += s.r * chorusSend;
+					}
+					posf += multiply;
+				}
+				return i;
+			}
+
+		private:
+			// 発音数制限 (超えた分をキーオフ済みの古いものから優先して、排他クラスと同じ短いリリースで終了させる)
+			// 途中で切るとクリックノイズになるので破棄はしない。短いリリース中のボイスは数えない
+			void cull() {
+				auto& v = m_voices;
+				if (m_maxVoices == 0 || v.size() <= m_maxVoices) return;
+				const auto* chokeEnvelope = &m_renderer.m_exclusiveClassEnvelope;
+				const size_t releasing = static_cast<size_t>(std::ranges::count(v.envelope, chokeEnvelope));
+				if (v.size() - releasing <= m_maxVoices) return;
+				size_t excess = v.size() - releasing - m_maxVoices;
+				for (size_t n = 0; n < v.size() && excess > 0; n++) {
+					if (v.keyoffPosition[n] == notKeyoff || v.envelope[n] == chokeEnvelope) continue;
+					quickRelease(n);		// リリース完了済のものは今回のレンダリングで終わる
+					excess--;
+				}
+				for (size_t n = 0; n < v.size() && excess > 0; n++) {
+					if (v.keyoffPosition[n] != notKeyoff) continue;
+					quickRelease(n);
+					excess--;
+				}
+			}
+
+			// [begin,end) のボイスをバスへ加算 (破棄対象のボイスは除く)
+			void renderVoices(size_t begin, size_t end, size_t size, const std::array<double, channelCount>& pitch, std::array<Output, channelCount>& outputs, std::array<size_t, channelCount>& lengths, std::array<bool, channelCount>& cleared, std::vector<T>& env) {
+				if (env.size() < size) env.resize(size);
+				auto& v = m_voices;
+				auto& finished = m_finished;
+				for (size_t n = begin; n < end; n++) {
+					if (finished[n]) continue;
+					const uint8_t ch = v.channel[n];
+					auto& output = outputs[ch];
+					if (!cleared[ch]) {
+						output.dry.assign(size, {});
+						output.reverb.clear();
+						output.chorus.clear();
+						cleared[ch] = true;
+					}
+					const bool send = v.reverbSend[n] > 0 || v.chorusSend[n] > 0;
+					if (send && output.reverb.empty()) {
+						output.reverb.assign(size, {});
+						output.chorus.assign(size, {});
+					}
+
+					// エンベロープ値(0.0～1.0) envSize が size 未満なら終了の意味
+					const size_t renderedSize = v.renderedSize[n];
+					size_t envSize = size;
+					if (v.keyoffPosition[n] != notKeyoff) {
+						envSize = v.envelope[n]->getGainsReleaseRate(renderedSize - v.keyoffPosition[n], env.data(), size);
+					} else {
+						v.envelope[n]->getGains(renderedSize, env.data(), size);
+					}
+
+					const double p = pitch[ch] + v.pitch[n];
+					const double multiply = p == 0.0 ?		// 乗値(=1サンプルあたり進む値)
+						v.advanceNormal[n] :
+						getAdvance(v.advanceBase[n], p, v.sampleRate[n], m_renderer.m_sampleRate);
+
+					double posf = v.position[n];
+					using Kernel = decltype(&renderVoice<false, false, false>);
+					static constexpr Kernel kernels[] = {		// [stereo][loop][send]
+						&renderVoice<false, false, false>, &renderVoice<false, false, true>, &renderVoice<true, false, false>, &renderVoice<true, false, true>,
+						&renderVoice<false, true, false>, &renderVoice<false, true, true>, &renderVoice<true, true, false>, &renderVoice<true, true, true>,
+					};
+					const Kernel kernel = kernels[(v.stereo[n] ? 4 : 0) + (v.loop[n] ? 2 : 0) + (send ? 1 : 0)];
+					const size_t i = kernel(v, n, posf, multiply, env.data(), envSize, output);
+					v.position[n] = posf;
+					v.renderedSize[n] = renderedSize + i;
+					lengths[ch] = (std::max)(lengths[ch], i);
+					finished[n] = i < size;		// size未満で抜けてきたら完了
+				}
+			}
+		public:
+
+			// 全ボイスを一括レンダリングしてチャンネル毎のバスへ加算する
+			// 発音のあったチャンネルのバスは size 要素に0クリアしてから加算(エフェクトへの送りのバスは送りのあるボイスがある場合のみ)
+			// ボイス数が多い場合は chunkVoices 単位で並列にレンダリングし、単位の順に加算する
+			// 戻り値はチャンネル毎の出力サンプル数(size未満なら完了)
+			std::array<size_t, channelCount> render(size_t size, const std::array<double, channelCount>& pitch, std::array<Output, channelCount>& outputs) {
+#ifdef DISABLE_THREADS
+				constexpr auto asyncLaunch = std::launch::deferred;
+#else
+				constexpr auto asyncLaunch = std::launch::async;
+#endif
+				std::array<size_t, channelCount> lengths = {};
+				std::array<bool, channelCount> cleared = {};
+
+				auto& v = m_voices;
+				auto& finished = m_finished;
+				finished.assign(v.size(), false);
+				cull();
+
+				const size_t chunks = (v.size() + chunkVoices - 1) / chunkVoices;
+				if (chunks > 1 && m_works.size() < chunks - 1) m_works.resize(chunks - 1);
+				std::vector<std::future<void>> futures;
+				for (size_t c = 1; c < chunks; c++) {
+					futures.emplace_back(std::async(asyncLaunch, [this, c, size, &pitch] {
+						auto& work = m_works[c - 1];
+						work.lengths = {};
+						work.cleared = {};
+						renderVoices(c * chunkVoices, (std::min)((c + 1) * chunkVoices, m_voices.size()), size, pitch, work.outputs, work.lengths, work.cleared, work.env);
+					}));
+				}
+				renderVoices(0, (std::min)(chunkVoices, v.size()), size, pitch, outputs, lengths, cleared, m_env);
+				for (size_t c = 1; c < chunks; c++) {		// 2単位目以降を順に加算
+					futures[c - 1].get();
+					const auto& work = m_works[c - 1];
+					const auto add = [size](Bus& dst, const Bus& src) {
+						for (size_t i = 0; i < size; i++) {
+							dst[i].l += src[i].l;
+							dst[i].r += src[i].r;
+						}
+					};
+					for (size_t ch = 0; ch < channelCount; ch++) {
+						if (!work.cleared[ch]) continue;
+						auto& output = outputs[ch];
+						const auto& src = work.outputs[ch];
+						if (!cleared[ch]) {
+							output.dry.assign(size, {});
+							output.reverb.clear();
+							output.chorus.clear();
+							cleared[ch] = true;
+						}
+						add(output.dry, src.dry);
+						if (!src.reverb.empty()) {
+							if (output.reverb.empty()) {
+								output.reverb.assign(size, {});
+								output.chorus.assign(size, {});
+							}
+							add(output.reverb, src.reverb);
+							add(output.chorus, src.chorus);
+						}
+						lengths[ch] = (std::max)(lengths[ch], work.lengths[ch]);
+					}
+				}
+
+				if (std::ranges::any_of(finished, [](uint8_t f) { return f != 0; })) {// 完了したボイスを破棄(発音順は維持)
+					for (size_t n = 0; n < v.size(); n++) m_keyVoices[keyIndex(v.channel[n], v.key[n])].clear();
+					for (auto& voices : m_channelVoices) voices.clear();
+					size_t dst = 0;
+					for (size_t n = 0; n < finished.size(); n++) {
+						if (finished[n]) continue;
+						if (dst != n) v.forEach([&](auto& a) { a[dst] = a[n]; });
+						dst++;
+					}
+					v.forEach([&](auto& a) { a.resize(dst); });
+					for (size_t n = 0; n < v.size(); n++) {		// 検索用の索引を作り直す
+						if (v.keyoffPosition[n] == notKeyoff) m_keyVoices[keyIndex(v.channel[n], v.key[n])].push_back(static_cast<uint32_t>(n));
+						m_channelVoices[v.channel[n]].push_back(static_cast<uint32_t>(n));
+					}
+				}
+				return lengths;
+			}
+
+			bool empty()const {
+				return m_voices.size() == 0;
+			}
+		};
 	};
 
 	using RendererF = RendererT<float>;
@@ -136,6 +136,34 @@ namespace rlib {
 			os << chunk;
 		}
 
+		// exportHeader で書ける data チャンクの最大バイト数 (RIFF のサイズが 32bit に収まり、サンプル単位で割り切れる長さ)
+		template<typename Sample> static constexpr uint32_t maxDataSize() {
+			constexpr uint32_t max = UINT32_MAX - static_cast<uint32_t>(4 + 8 + sizeof(WaveformatEx) + 8);
+			return max - max % sizeof(Sample);
+		}
+
+		// ヘッダのみ出力 (data チャンクのデータ(dataSize バイト)は呼び出し側で続けて出力する)
+		template<typename Sample> static void exportHeader(std::ostream& os, uint32_t sampleRate, uint32_t dataSize) {
+			const auto write = [&os](const auto& t) {
+				os.write(reinterpret_cast<const char*>(&t), sizeof(t));
+			};
+			WaveformatEx f;
+			f.nChannels = SampleTraits<Sample>::channels;
+			f.wBitsPerSample = SampleTraits<Sample>::bits;
+			f.wFormatTag = SampleTraits<Sample>::formatTag;
+			f.nSamplesPerSec = sampleRate;
+			f.nBlockAlign = f.nChannels * f.wBitsPerSample / 8;
+			f.nAvgBytesPerSec = f.nSamplesPerSec * f.nBlockAlign;
+
+			os.write("RIFF", 4);
+			write(static_cast<uint32_t>(4 + 8 + sizeof(f) + 8 + dataSize));
+			os.write("WAVEfmt ", 8);
+			write(static_cast<uint32_t>(sizeof(f)));
+			write(f);
+			os.write("data", 4);
+			write(dataSize);
+		}
+
 		static Wav fromStream(std::istream& is) {
 			using namespace riff;
 			const auto toArray = [](const std::string& s) {
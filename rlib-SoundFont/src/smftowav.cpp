@@ -53,6 +53,12 @@ int main(const int argc, const char* const argv[])
 		std::string input = "-", output = "-";
 		std::string pathSoundfont, pathSoundfontDir;
 		std::string outFormat = "wav";
+		std::string fidelity = "max";
+		std::string engine = "note";
+		std::string fmEngine = "note";
+		std::string psgOscillator = "chip";
+		size_t maxVoices = 0;
+		size_t eventQuantum = 0;
 		po::options_description desc("options");
 		desc.add_options()
 			("version", "show version")
@@ -64,7 +70,25 @@ int main(const int argc, const char* const argv[])
 			("output,o", po::value(&output), "output file (wav | pcm)")						// 出力ファイル
 			("out-format",
 				po::value(&outFormat)->default_value("wav"),
-				"output format (wav | pcm)");
+				"output format (wav | pcm)")
+			("fidelity",
+				po::value(&fidelity)->default_value("max"),
+				"fm/psg chip fidelity (min | med | max)")						// FM/PSG音源のチップの忠実度(下げるとレンダリングが速くなる)
+			("engine",
+				po::value(&engine)->default_value("note"),
+				"soundfont render engine (note | voice)")						// SoundFont音源のレンダリング方式(voice:大量のノートを含む曲向け)
+			("fm-engine",
+				po::value(&fmEngine)->default_value("note"),
+				"fm render engine (note | pool | voice)")						// FM音源のレンダリング方式(pool,voice:同時発音数が多い曲向け)
+			("psg-oscillator",
+				po::value(&psgOscillator)->default_value("chip"),
+				"psg oscillator (chip | analytic)")								// PSG音源の波形の生成方法(analytic:チップを使わず直接生成。速い)
+			("max-voices",
+				po::value(&maxVoices)->default_value(0),
+				"soundfont max voices, voice engine only (0 = unlimited)")		// SoundFont音源の最大ボイス数
+			("event-quantum",
+				po::value(&eventQuantum)->default_value(0),
+				"min samples rendered between events (0 = exact)");			// イベント間の最小レンダリングサンプル数(イベントは最大でこの分早まる)
 
 		po::positional_options_description pd;
 		// pd.add("input", -1);
@@ -117,19 +141,22 @@ int main(const int argc, const char* const argv[])
 
 		po::notify(vm);
 
-		const auto smf = [&] {
-			if (input != "-") {
-				auto path = std::filesystem::path(input);
-				std::ifstream fs(path, std::ios::in | std::ios::binary);
-				if (fs.fail()) throw std::runtime_error("input file open error.");
-				return midi::Smf::fromStream(fs);
-			}
-			std::cin >> std::noskipws;  // 改行や空白を端折らない
-			return midi::Smf::fromStream(std::cin);
+		const auto smfToWav = [&] {		// 変換後の SMF は不要なので、ここで破棄する
+			const auto data = [&] {		// ファイル全体を読み込んで、メモリ上で直接パースする
+				if (input != "-") {
+					auto path = std::filesystem::path(input);
+					std::ifstream fs(path, std::ios::in | std::ios::binary);
+					if (fs.fail()) throw std::runtime_error("input file open error.");
+					return std::vector<uint8_t>(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+				}
+				std::cin >> std::noskipws;  // 改行や空白を端折らない
+				return std::vector<uint8_t>(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+			}();
+			return SmfToWav::create(midi::Smf::fromMemory(data));
 		}();
 
-		const auto smfToWav = SmfToWav::create(smf);
-		const auto midiModules = smfToWav.makeMidiModules<float>(std::filesystem::path(pathSoundfont), std::filesystem::path(pathSoundfontDir), 44100);
+		const auto midiModules = smfToWav.makeMidiModules<float>(std::filesystem::path(pathSoundfont), std::filesystem::path(pathSoundfontDir), 44100, fm::toFidelity(fidelity),
+			soundfont::MidiModuleT<float>::toEngine(engine), maxVoices, fm::MidiModuleT<float>::toEngine(fmEngine), fm::psg::MidiModuleT<float>::toOscillator(psgOscillator));
 
 		std::ofstream ofs;
 		std::ostream& os = [&]() -> decltype(os) {
@@ -146,10 +173,9 @@ int main(const int argc, const char* const argv[])
 				using Sample = std::decay_t<decltype(samples.front())>;
 				static_assert(std::is_trivially_copyable_v<Sample>);
 				os.write(reinterpret_cast<const char*>(samples.data()),samples.size() * sizeof(Sample));
-			});
+			}, eventQuantum);
 		} else {
-			const auto wav = smfToWav.toWav(midiModules.refMap);
-			wav.exportFile(os);
+			smfToWav.exportWav(midiModules.refMap, os, eventQuantum);		// 順次出力 (標準出力がパイプの場合、ヘッダのデータ長は最大値になる)
 		}
 		os.flush();
 
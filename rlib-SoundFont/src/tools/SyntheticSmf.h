@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../sequencer/MidiEvent.h"
+#include "../sequencer/Smf.h"
+
+// ベンチマーク・検証用の合成 SMF
+namespace rlib::tools {
+
+	struct SyntheticSmfOptions {
+		size_t						notes = 1000;		// 総ノート数 (各トラックに均等に割り振る)
+		size_t						tracks = 1;			// ノートを置くトラック数 (テンポ用のトラックは別に付ける)
+		double						seconds = 10.0;		// 曲の長さ(秒) テンポは120固定
+		int							timeBase = 480;		// 分解能
+		std::vector<std::string>	instruments;		// トラック毎の instrument 名 (トラック順に繰り返し使う。空なら instrument 指定なし)
+		uint8_t						program = 0;		// 全チャンネルのプログラム番号
+		uint32_t					seed = 1;			// 乱数の種 (同じ値なら同じ SMF になる)
+	};
+
+	// ノートの位置・音程・ベロシティ・長さを乱数で決めた SMF を生成
+	// トラック n はチャンネル n % 15 (ドラムの ch.10 は使わない)
+	inline midi::Smf makeSyntheticSmf(const SyntheticSmfOptions& options) {
+		if (options.tracks == 0 || options.tracks > 0xffff - 1) throw std::runtime_error("invalid track count.");
+		if (options.timeBase <= 0 || options.timeBase > 0x7fff) throw std::runtime_error("invalid time base.");
+		if (!(options.seconds > 0)) throw std::runtime_error("invalid length.");
+
+		midi::Smf smf;
+		smf.timeBase = options.timeBase;
+		const auto timeBase = static_cast<size_t>(options.timeBase);
+		const auto length = static_cast<size_t>(options.seconds * 2 * timeBase);	// 曲の長さ(tick) 120bpm なので1秒は2拍
+
+		{// テンポ
+			constexpr uint32_t tempo = 500000;		// 4分音符の長さ(マイクロ秒) = 120bpm
+			const uint8_t data[] = { tempo >> 16 & 0xff, tempo >> 8 & 0xff, tempo & 0xff };
+			auto& track = smf.tracks.emplace_back();
+			track.events.emplace(0, midi::EventMeta::statusByte, static_cast<uint8_t>(midi::EventMeta::Type::tempo), data);
+		}
+
+		std::mt19937 random(options.seed);
+		for (size_t t = 0; t < options.tracks; t++) {
+			auto& track = smf.tracks.emplace_back();
+			auto& events = track.events;
+			const size_t notes = options.notes / options.tracks + (t < options.notes % options.tracks ? 1 : 0);
+			events.reserve(notes * 2 + 2);
+
+			if (!options.instruments.empty()) {
+				const auto& instrument = options.instruments[t % options.instruments.size()];
+				const std::vector<uint8_t> data(instrument.begin(), instrument.end());
+				events.emplace(0, midi::EventMeta::statusByte, static_cast<uint8_t>(midi::EventMeta::Type::instrumentName), data);
+			}
+			const uint8_t channel = static_cast<uint8_t>(t % 15 < 9 ? t % 15 : t % 15 + 1);
+			events.emplace(0, midi::EventProgramChange::statusByte | channel, options.program & 0x7f);
+
+			for (size_t n = 0; n < notes; n++) {
+				const size_t duration = timeBase / 8 + random() % (timeBase * 2);	// 32分音符～2拍強
+				const size_t position = 1 + random() % (std::max<size_t>(length, duration + 2) - duration - 1);
+				const uint8_t key = static_cast<uint8_t>(36 + random() % 60);
+				const uint8_t velocity = static_cast<uint8_t>(64 + random() % 64);
+				events.emplace(position, midi::EventNoteOn::statusByte | channel, key, velocity);
+				events.emplace(position + duration, midi::EventNoteOff::statusByte | channel, key, 0);	// 位置は前後するが Events が整列する
+			}
+		}
+		return smf;
+	}
+
+}
@@ -0,0 +1,104 @@
+﻿
+// FM/PSG 音源のチップの忠実度(--fidelity)毎のレンダリング速度を計測する
+// 入力 SMF を指定しない場合は FM/PSG のトラックを持つ合成 SMF を使う
+
+#ifndef _MSC_VER
+#include <bits/stdc++.h>
+#else
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#endif
+
+#include <boost/program_options.hpp>
+
+#include "../sequencer/SmfToWav.h"
+#include "./SyntheticSmf.h"
+
+using namespace rlib;
+
+
+int main(const int argc, const char* const argv[])
+{
+	namespace po = boost::program_options;
+
+	try {
+		std::string input, pathSoundfont;
+		std::string fmEngine = "note";
+		tools::SyntheticSmfOptions synthetic;
+		synthetic.notes = 400;
+		synthetic.tracks = 4;
+		synthetic.seconds = 10;
+		synthetic.instruments = { "fm", "psg" };
+		po::options_description desc("options");
+		desc.add_options()
+			("help", "show help")
+			("input,i", po::value(&input), "input file (mid). synthetic fm/psg song if omitted")		// 入力SMFファイルパス(省略時は合成SMF)
+			("soundfont,s", po::value(&pathSoundfont), "soundfont for non fm/psg tracks")			// FM/PSG以外のトラック用のSoundfont(省略時はFM/PSGで代用)
+			("fm-engine", po::value(&fmEngine)->default_value("note"), "fm render engine (note | pool | voice)")
+			("notes", po::value(&synthetic.notes)->default_value(synthetic.notes), "synthetic song: notes")
+			("tracks", po::value(&synthetic.tracks)->default_value(synthetic.tracks), "synthetic song: tracks")
+			("seconds", po::value(&synthetic.seconds)->default_value(synthetic.seconds), "synthetic song: length in seconds");
+
+		po::variables_map vm;
+		po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		po::notify(vm);
+
+		const auto smfToWav = [&] {
+			if (input.empty()) return SmfToWav::create(tools::makeSyntheticSmf(synthetic));
+			std::ifstream fs(std::filesystem::path(input), std::ios::in | std::ios::binary);
+			if (fs.fail()) throw std::runtime_error("input file open error.");
+			const std::vector<uint8_t> data(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>{});
+			return SmfToWav::create(midi::Smf::fromMemory(data));
+		}();
+		const auto spSoundfont = [&]() -> std::shared_ptr<const soundfont::Soundfont> {
+			if (pathSoundfont.empty()) return nullptr;
+			std::ifstream fs(std::filesystem::path(pathSoundfont), std::ios::in | std::ios::binary);
+			if (fs.fail()) throw std::runtime_error("soundfont file open error.");
+			return std::make_shared<const soundfont::Soundfont>(soundfont::Soundfont::fromStream(fs));
+		}();
+
+		constexpr uint32_t sampleRate = 44100;
+		std::printf("fidelity  render[s]  audio[s]  realtime\n");
+		for (const auto fidelity : { "min", "med", "max" }) {
+			// 忠実度毎に MidiModule を作り直す (SoundFont が無ければ FM/PSG 以外のトラックは先頭の MidiModule で鳴らす)
+			std::vector<std::shared_ptr<midi::MidiModuleBase<float>>> instances;
+			std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<float>>> midiModuleMap;
+			for (auto& [instrument, events] : smfToWav.m_mapEvents) {
+				if (instrument == "fm") {
+					instances.push_back(std::make_shared<fm::MidiModuleT<float>>(sampleRate, fm::MidiModuleT<float>::toEngine(fmEngine), fm::toFidelity(fidelity)));
+				} else if (instrument == "psg") {
+					instances.push_back(std::make_shared<fm::psg::MidiModuleT<float>>(sampleRate, fm::toFidelity(fidelity)));
+				} else if (spSoundfont) {
+					instances.push_back(std::make_shared<soundfont::MidiModuleT<float>>(spSoundfont, sampleRate));
+				} else {
+					continue;
+				}
+				midiModuleMap.emplace(instrument, *instances.back());
+			}
+			if (midiModuleMap.empty()) throw std::runtime_error("no fm/psg track. specify a soundfont.");
+
+			size_t samples = 0;
+			const auto begin = std::chrono::steady_clock::now();
+			smfToWav.toPcm(midiModuleMap, [&](auto& s) { samples += s.size(); });
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+			const double audio = static_cast<double>(samples) / sampleRate;
+			std::printf("%-8s  %9.3f  %8.2f  %7.1fx\n", fidelity, elapsed.count(), audio, audio / elapsed.count());
+		}
+
+	} catch (std::exception& e) {
+		std::clog << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
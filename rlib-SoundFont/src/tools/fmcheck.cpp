@@ -0,0 +1,202 @@
+﻿
+// FM 音源の VoiceEngine (ymfm の移植) が ChipPool (ymfm の FM部そのもの) と同じ出力になっているかの確認
+// 1. 同じ位置のノートオフ→ノートオン(同一キー)が、キーオフ→1クロック→キーオンとしてチップへ伝わり再アタックすること
+//    (ChipPool を FmChip2203 を直接操作した結果と、VoiceEngine を ChipPool と比べる)
+// 2. 全アルゴリズム・フィードバックの乱数の音色とイベント列(キーオフ,再キーオン,ピッチベンド)で VoiceEngine と ChipPool が一致すること
+// どちらもチップのサンプリングレートのまま比べる (Resampler を通す前)
+
+#ifndef _MSC_VER
+#include <bits/stdc++.h>
+#else
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <random>
+#endif
+
+#include "../sequencer/SmfToWav.h"
+
+using namespace rlib;
+
+
+namespace {
+	using Renderer = fm::RendererT<float>;
+	using Program = fm::ChipWrapper2203::FmProgramReg;
+
+	constexpr float maxDiff = 1e-6f;		// 許容する差 (ボイスを加算する順序による丸め誤差)
+	constexpr uint8_t carriers[8] = { 0b1000, 0b1000, 0b1000, 0b1000, 0b1010, 0b1110, 0b1110, 0b1111 };	// アルゴリズム毎のキャリア (bit0～3:op1～op4)
+
+	// 乱数の音色
+	// キャリアはサステインレートを0、サステインレベルを無音未満にして、キーオン中に発音完了(ボイスの解放)とならないようにする
+	// (ChipPool は解放したチャンネルの状態を引き継ぐので、ボイスの解放と再利用があると VoiceEngine と一致しない)
+	Program makeProgram(std::mt19937& random, uint8_t algorithm, uint8_t feedback) {
+		Program program{};
+		for (uint8_t op = 0; op < 4; op++) {
+			auto& ope = program.ope[op];
+			const bool carrier = (carriers[algorithm] >> op) & 1;
+			ope.ar = static_cast<uint8_t>(10 + random() % 22);
+			ope.dr = static_cast<uint8_t>(random() % 32);
+			ope.sr = carrier ? 0 : static_cast<uint8_t>(random() % 32);
+			ope.rr = static_cast<uint8_t>(random() % 16);
+			ope.sl = static_cast<uint8_t>(random() % (carrier ? 14 : 16));
+			ope.tl = static_cast<uint8_t>(carrier ? random() % 40 : random() % 128);
+			ope.ks = static_cast<uint8_t>(random() % 4);
+			ope.ml = static_cast<uint8_t>(random() % 16);
+			ope.dt = static_cast<uint8_t>(random() % 8);
+		}
+		program.al = algorithm;
+		program.fb = feedback;
+		return program;
+	}
+
+	float amplitude(uint8_t velocity) {		// ChipPool, VoiceEngine と同じ 16bit → float の係数
+		return (static_cast<float>(1.0) / 32767) * midi::volumeGainTable<float>[velocity];
+	}
+
+	// engine を size クロック分レンダリングして out へ追加 (発音完了で短くなった分は無音)
+	template <typename Engine> void render(Engine& engine, size_t size, std::vector<float>& out) {
+		auto samples = engine.render(size);
+		samples.resize(size);
+		out.insert(out.end(), samples.begin(), samples.end());
+	}
+
+	float getMaxDiff(const std::vector<float>& a, const std::vector<float>& b) {
+		if (a.size() != b.size()) throw std::runtime_error("size mismatch.");
+		float diff = 0;
+		for (size_t i = 0; i < a.size(); i++) diff = (std::max)(diff, std::abs(a[i] - b[i]));
+		return diff;
+	}
+
+	// 1. 同じ位置のノートオフ→ノートオン
+	bool checkRetrigger(Renderer& renderer, const Program& program) {
+		constexpr uint8_t note = 60, velocity = 100;
+		constexpr size_t before = 3000, after = 3000;		// 再キーオンの前後のクロック数
+		const Renderer::PresetKey presetKey{ note, velocity, 0.0 };
+
+		// 正解: FmChip2203 を直接操作し、キーオフとキーオンの間に1クロック入れる
+		std::vector<float> expected;
+		{
+			fm::FmChip2203 chip;
+			chip.fmSetProgram(program, 0);
+			chip.fmSetPitch(note, 0.0, 0);
+			chip.fmNoteOn(0);
+			std::vector<fm::FmChip2203::Outputs> outputs(before + after);
+			chip.clock(1, outputs.data(), before);
+			chip.fmNoteOff(0);
+			chip.clock(1, outputs.data() + before, 1);
+			chip.fmNoteOn(0);
+			chip.clock(1, outputs.data() + before + 1, after - 1);
+			for (auto& o : outputs) expected.push_back(o[0] * amplitude(velocity));
+		}
+		// キーオンしたまま(再アタック無し)
+		std::vector<float> held;
+		{
+			auto pool = renderer.createChipPool();
+			pool->noteOn(note, presetKey, program, 0.0);
+			render(*pool, before + after, held);
+		}
+
+		const auto run = [&](auto engine) {
+			std::vector<float> result;
+			engine->noteOn(note, presetKey, program, 0.0);
+			render(*engine, before, result);
+			engine->noteOff(note);
+			engine->noteOn(note, presetKey, program, 0.0);
+			render(*engine, after, result);
+			return result;
+		};
+		const auto pool = run(renderer.createChipPool());
+		const auto voice = run(renderer.createVoiceEngine());
+
+		const float poolDiff = getMaxDiff(expected, pool);
+		const float voiceDiff = getMaxDiff(pool, voice);
+		const float heldDiff = getMaxDiff(expected, held);
+		std::printf("retrigger al=%u fb=%u: pool/chip %.2e voice/pool %.2e (held/chip %.2e)\n", program.al, program.fb, poolDiff, voiceDiff, heldDiff);
+		if (heldDiff <= maxDiff) throw std::runtime_error("retrigger case does not re-attack. check the program.");	// 検証の前提
+		return poolDiff <= maxDiff && voiceDiff <= maxDiff;
+	}
+
+	// 2. 乱数のイベント列 (3キーを1チップの3チャンネルに割り当てる)
+	bool checkSequence(Renderer& renderer, std::mt19937& random, const Program& program) {
+		constexpr uint8_t keys = 3;
+		constexpr size_t events = 60;
+		auto pool = renderer.createChipPool();
+		auto voice = renderer.createVoiceEngine();
+		std::vector<float> poolOut, voiceOut;
+		const auto renderBoth = [&](size_t size) {
+			render(*pool, size, poolOut);
+			render(*voice, size, voiceOut);
+		};
+		const auto noteOn = [&](uint8_t key, double pitch) {
+			const Renderer::PresetKey presetKey{ static_cast<uint8_t>(40 + key * 7 + random() % 5), static_cast<uint8_t>(64 + random() % 64), 0.0 };
+			pool->noteOn(key, presetKey, program, pitch);
+			voice->noteOn(key, presetKey, program, pitch);
+		};
+		const auto noteOff = [&](uint8_t key) {
+			pool->noteOff(key);
+			voice->noteOff(key);
+		};
+
+		double pitch = 0.0;
+		for (uint8_t key = 0; key < keys; key++) noteOn(key, pitch);		// チャンネル0～2
+		for (size_t e = 0; e < events; e++) {
+			renderBoth(1 + random() % 2000);
+			const uint8_t key = static_cast<uint8_t>(random() % keys);
+			switch (random() % 4) {
+			case 0:		// 同じ位置のノートオフ→ノートオン
+				noteOff(key);
+				noteOn(key, pitch);
+				break;
+			case 1:		// キーオン中の再ノートオン
+				noteOn(key, pitch);
+				break;
+			case 2:		// ノートオフ→少し後にノートオン (発音完了の判定(無音16サンプル超)より前)
+				noteOff(key);
+				renderBoth(1 + random() % 16);
+				noteOn(key, pitch);
+				break;
+			default:	// ピッチベンド
+				pitch = static_cast<double>(static_cast<int>(random() % 8193) - 4096) / 4096 * 2;
+				pool->setPitchBend(pitch);
+				voice->setPitchBend(pitch);
+				break;
+			}
+		}
+		for (uint8_t key = 0; key < keys; key++) noteOff(key);
+		renderBoth(60000);
+
+		const float diff = getMaxDiff(poolOut, voiceOut);
+		if (diff > maxDiff) std::printf("sequence al=%u fb=%u: voice/pool %.2e\n", program.al, program.fb, diff);
+		return diff <= maxDiff;
+	}
+}
+
+
+int main()
+{
+	try {
+		Renderer renderer(44100);
+		std::mt19937 random(1);
+		size_t failed = 0, count = 0;
+		for (uint8_t algorithm = 0; algorithm < 8; algorithm++) {
+			for (const uint8_t feedback : { uint8_t(0), static_cast<uint8_t>(1 + random() % 7) }) {
+				if (!checkRetrigger(renderer, makeProgram(random, algorithm, feedback))) failed++;
+				for (size_t i = 0; i < 4; i++, count++) {
+					if (!checkSequence(renderer, random, makeProgram(random, algorithm, feedback))) failed++;
+				}
+			}
+		}
+		std::printf("%zu random sequences checked.\n", count);
+		if (failed) {
+			std::clog << failed << " fm checks failed." << std::endl;
+			return 1;
+		}
+
+	} catch (std::exception& e) {
+		std::clog << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+﻿
+// PSG 音源の Oscillator::analytic が Oscillator::chip (ymfm) と同じ音になっているかの確認
+// トーンのみの合成 SMF (ピッチベンド含む) を両方でレンダリングし、可聴域(ローパス後)の RMS 差が閾値以内であることを確かめる
+// チップ側は間引きによる折り返しを含むので、差はローパスしてから比べる (analytic は polyBLEP のため1サンプル遅れる)
+
+#ifndef _MSC_VER
+#include <bits/stdc++.h>
+#else
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#endif
+
+#include "../sequencer/SmfToWav.h"
+#include "./SyntheticSmf.h"
+
+using namespace rlib;
+
+
+int main()
+{
+	constexpr uint32_t sampleRate = 44100;
+	constexpr double maxRmsDiff = 0.06;		// 許容する RMS 差 (チップ側の RMS に対する比)
+	constexpr size_t lag = 1;				// analytic の遅れ(サンプル数)
+	constexpr size_t lowpass = 16;			// 移動平均のサンプル数 (最初のヌルは約2.7kHz)
+
+	try {
+		const auto smfToWav = [] {
+			tools::SyntheticSmfOptions options;
+			options.notes = 96;
+			options.tracks = 3;
+			options.seconds = 8;
+			options.instruments = { "psg" };
+			options.program = 2;		// トーンのみの音色
+			auto smf = tools::makeSyntheticSmf(options);
+			size_t channel = 0;
+			for (auto it = std::next(smf.tracks.begin()); it != smf.tracks.end(); ++it, channel++) {	// 先頭はテンポのトラック
+				for (size_t i = 0; i < 32; i++) {		// ピッチベンドで周期を変える
+					const int value = 8192 + static_cast<int>((i % 8) * 512) - 2048;
+					it->events.emplace(i * 480 + 50, midi::EventPitchBend::statusByte | static_cast<uint8_t>(channel), value & 0x7f, value >> 7 & 0x7f);
+				}
+			}
+			return SmfToWav::create(smf);
+		}();
+
+		const auto render = [&](fm::psg::MidiModuleT<float>::Oscillator oscillator) {
+			fm::psg::MidiModuleT<float> midiModule(sampleRate, fm::Fidelity::max, oscillator);
+			std::map<std::string, std::reference_wrapper<midi::MidiModuleBase<float>>> midiModuleMap;
+			midiModuleMap.emplace("psg", midiModule);
+			std::vector<double> result;		// 左チャンネルをローパスしたもの
+			double sum = 0;
+			std::deque<float> window;
+			smfToWav.toPcm(midiModuleMap, [&](auto& samples) {
+				for (auto& s : samples) {
+					sum += s.l;
+					window.push_back(s.l);
+					if (window.size() > lowpass) {
+						sum -= window.front();
+						window.pop_front();
+					}
+					result.push_back(sum / lowpass);
+				}
+			});
+			return result;
+		};
+		const auto chip = render(fm::psg::MidiModuleT<float>::Oscillator::chip);
+		const auto analytic = render(fm::psg::MidiModuleT<float>::Oscillator::analytic);
+
+		const size_t size = std::min(chip.size(), analytic.size() - lag);
+		double power = 0, diff = 0;
+		for (size_t i = 0; i < size; i++) {
+			power += chip[i] * chip[i];
+			diff += (chip[i] - analytic[i + lag]) * (chip[i] - analytic[i + lag]);
+		}
+		if (size == 0 || power <= 0) throw std::runtime_error("no output.");
+		const double ratio = std::sqrt(diff / power);
+
+		std::printf("psg chip/analytic lowpassed rms diff %.4f (limit %.4f)\n", ratio, maxRmsDiff);
+		if (ratio > maxRmsDiff) {
+			std::clog << "psg analytic oscillator differs from the chip." << std::endl;
+			return 1;
+		}
+
+	} catch (std::exception& e) {
+		std::clog << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+﻿
+// 負荷試験用の合成 SMF を出力する (N ノート・M トラック)
+// 例: smfgen --notes 10000000 --tracks 16 --seconds 600 -o big.mid
+//     smftowav -i big.mid -s xxx.sf2 --engine voice --max-voices 64 --event-quantum 64 -o big.wav
+// 1000万ノートが1分程度で変換できるのは、ボイス数の上限とイベントの量子化(どちらも出力が変わる)を指定した場合のみ
+// (並列化されるのは SMF のトラックの読み込みと SoundFont のボイスのレンダリングのみで、イベントの処理と FM/PSG のレンダリングはシングルスレッド)
+
+#ifndef _MSC_VER
+#include <bits/stdc++.h>
+#else
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#endif
+
+#include <boost/program_options.hpp>
+
+#include "./SyntheticSmf.h"
+
+using namespace rlib;
+
+
+int main(const int argc, const char* const argv[])
+{
+	namespace po = boost::program_options;
+
+	try {
+		std::string output;
+		int program = 0;
+		tools::SyntheticSmfOptions options;
+		po::options_description desc("options");
+		desc.add_options()
+			("help", "show help")
+			("output,o", po::value(&output)->required(), "output file (mid)")		// 出力SMFファイルパス
+			("notes", po::value(&options.notes)->default_value(options.notes), "notes")
+			("tracks", po::value(&options.tracks)->default_value(options.tracks), "tracks (a tempo track is added)")
+			("seconds", po::value(&options.seconds)->default_value(options.seconds), "length in seconds (120 bpm)")
+			("time-base", po::value(&options.timeBase)->default_value(options.timeBase), "ticks per quarter note")
+			("instrument", po::value(&options.instruments)->multitoken(), "instrument name per track (fm | psg | soundfont file name. repeated over tracks)")
+			("program", po::value(&program)->default_value(program), "program number")
+			("seed", po::value(&options.seed)->default_value(options.seed), "random seed");
+
+		po::variables_map vm;
+		po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+		if (vm.count("help")) {
+			std::cout << desc << std::endl;
+			return 0;
+		}
+		po::notify(vm);
+		if (program < 0 || program > 0x7f) throw std::runtime_error("invalid program number.");
+		options.program = static_cast<uint8_t>(program);
+
+		const auto fileImage = tools::makeSyntheticSmf(options).getFileImage();
+		std::ofstream ofs(std::filesystem::path(output), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (ofs.fail()) throw std::runtime_error("output file open error.");
+		ofs.write(reinterpret_cast<const char*>(fileImage.data()), fileImage.size());
+		if (ofs.fail()) throw std::runtime_error("output file write error.");
+
+	} catch (std::exception& e) {
+		std::clog << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
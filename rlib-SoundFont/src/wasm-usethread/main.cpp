@@ -16,6 +16,8 @@
 #include "../sequencer/SoundfontInfo.h"
 #include "../sequencer/Smf.h"
 #include "../sequencer/SmfToWav.h"
+#include "../sequencer/FmMidiModule.h"
+#include "../sequencer/PsgMidiModule.h"
 
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
@@ -89,26 +91,52 @@ public:
 	{}
 };
 
-AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
+// fidelity:FM/PSG音源のチップの忠実度 ("min" | "med" | "max")
+// fmEngine:FM音源のレンダリング方式 ("note" | "pool" | "voice")
+// psgOscillator:PSG音源の波形の生成方法 ("chip" | "analytic")
+AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity, const std::string& fmEngine, const std::string& psgOscillator) {
 	std::cout << "smfToWav" << std::endl;
-	auto f = std::async(std::launch::async, [soundFont, is = std::istringstream(smfBinary, std::istringstream::binary)]()mutable->AppFuture::ValueType {
+	auto f = std::async(std::launch::async, [soundFont, smfBinary, fidelity, fmEngine, psgOscillator]()mutable->AppFuture::ValueType {
 		try {
 			// Uint8Array であるかどうかをチェック
 			//if (!smfBinary.instanceof(emscripten::val::global("Uint8Array"))) {
 			//	std::cerr << "Error: Argument is not a Uint8Array." << std::endl;
 			//	throw std::runtime_error("Error: Argument is not a Uint8Array.");
 			//}
-			auto smf = rlib::midi::Smf::fromStream(is);
+			auto smf = rlib::midi::Smf::fromMemory(std::span(reinterpret_cast<const uint8_t*>(smfBinary.data()), smfBinary.size()));
 
 			auto output = [&] {
 				std::ostringstream oss;
 				{
+					constexpr uint32_t sampleRate = 44100;
+					const auto fmFidelity = rlib::fm::toFidelity(fidelity);
+					const auto fmEngineType = rlib::fm::MidiModuleT<float>::toEngine(fmEngine);
+					const auto psgOscillatorType = rlib::fm::psg::MidiModuleT<float>::toOscillator(psgOscillator);
 					const auto smfToWav = rlib::SmfToWav::create(smf);
-					rlib::soundfont::MidiModuleT<float> midiModule(*soundFont, 44100);
+
+					// トラック(CreatePortのinstrument)ごとにMidiModuleを用意する
+					// instrument が "fm"/"psg" ならymfmベースのFM/PSG音源、それ以外(既定含む)は読み込み済みのSoundFontで再生する
+					std::vector<std::shared_ptr<rlib::midi::MidiModuleBase<float>>> instances;
 					std::map<std::string, std::reference_wrapper<rlib::midi::MidiModuleBase<float>>> mapMidiModule;
-					mapMidiModule.emplace("", midiModule);
-					const rlib::Wav wav = smfToWav.toWav<float>(mapMidiModule, 44100);
-					wav.exportFile(oss);
+					const auto ensureModule = [&](const std::string& instrument) -> rlib::midi::MidiModuleBase<float>& {
+						if (instrument == "fm") {
+							instances.push_back(std::make_shared<rlib::fm::MidiModuleT<float>>(sampleRate, fmEngineType, fmFidelity));
+						} else if (instrument == "psg") {
+							instances.push_back(std::make_shared<rlib::fm::psg::MidiModuleT<float>>(sampleRate, fmFidelity, psgOscillatorType));
+						} else {
+							instances.push_back(std::make_shared<rlib::soundfont::MidiModuleT<float>>(*soundFont, sampleRate));
+						}
+						return *instances.back();
+					};
+					if (smfToWav.m_mapEvents.empty()) {
+						mapMidiModule.emplace("", ensureModule(""));
+					} else {
+						for (auto& [instrument, events] : smfToWav.m_mapEvents) {
+							mapMidiModule.emplace(instrument, ensureModule(instrument));
+						}
+					}
+
+					smfToWav.exportWav<float>(mapMidiModule, oss);		// 曲の長さの制限なし (wav の形式上の上限まで)
 				}
 				return oss.str();
 			}();
@@ -124,10 +152,25 @@ AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
 	return AppFuture(std::move(f));
 }
 
+AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity, const std::string& fmEngine) {
+	return smfToWav(soundFont, smfBinary, fidelity, fmEngine, "chip");
+}
+
+AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity) {
+	return smfToWav(soundFont, smfBinary, fidelity, "note");
+}
+
+AppFuture smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
+	return smfToWav(soundFont, smfBinary, "max");
+}
+
 
 EMSCRIPTEN_BINDINGS(moduleSoundfont) {
     emscripten::function("loadSoundfont", &loadSoundfont, emscripten::return_value_policy::take_ownership());
-    emscripten::function("smfToWav", &smfToWav, emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<AppFuture(Soundfont*, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<AppFuture(Soundfont*, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<AppFuture(Soundfont*, const std::string&, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<AppFuture(Soundfont*, const std::string&, const std::string&, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
 
 	emscripten::class_<Soundfont>("Soundfont")
 		.function("info", std::function{ [](const Soundfont& self) {
@@ -79,15 +79,20 @@ Soundfont loadSoundfont(const std::string& sfBinary) {
 	return soundfont;
 }
 
-emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
+// fidelity:FM/PSG音源のチップの忠実度 ("min" | "med" | "max")
+// fmEngine:FM音源のレンダリング方式 ("note" | "pool" | "voice")
+// psgOscillator:PSG音源の波形の生成方法 ("chip" | "analytic")
+emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity, const std::string& fmEngine, const std::string& psgOscillator) {
 	// std::cout << "smfToWav" << std::endl;
 	auto ret = emscripten::val::object();
 	try{
 		std::ostringstream oss;
 		{
 			constexpr uint32_t sampleRate = 44100;
-			auto is = std::istringstream(smfBinary, std::istringstream::binary);
-			auto smf = rlib::midi::Smf::fromStream(is);
+			const auto fmFidelity = rlib::fm::toFidelity(fidelity);
+			const auto fmEngineType = rlib::fm::MidiModuleT<float>::toEngine(fmEngine);
+			const auto psgOscillatorType = rlib::fm::psg::MidiModuleT<float>::toOscillator(psgOscillator);
+			auto smf = rlib::midi::Smf::fromMemory(std::span(reinterpret_cast<const uint8_t*>(smfBinary.data()), smfBinary.size()));
 			const auto smfToWav = rlib::SmfToWav::create(smf);
 
 			// トラック(CreatePortのinstrument)ごとにMidiModuleを用意する
@@ -96,9 +101,9 @@ emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
 			std::map<std::string, std::reference_wrapper<rlib::midi::MidiModuleBase<float>>> mapMidiModule;
 			const auto ensureModule = [&](const std::string& instrument) -> rlib::midi::MidiModuleBase<float>& {
 				if (instrument == "fm") {
-					instances.push_back(std::make_shared<rlib::fm::MidiModuleT<float>>(sampleRate));
+					instances.push_back(std::make_shared<rlib::fm::MidiModuleT<float>>(sampleRate, fmEngineType, fmFidelity));
 				} else if (instrument == "psg") {
-					instances.push_back(std::make_shared<rlib::fm::psg::MidiModuleT<float>>(sampleRate));
+					instances.push_back(std::make_shared<rlib::fm::psg::MidiModuleT<float>>(sampleRate, fmFidelity, psgOscillatorType));
 				} else {
 					instances.push_back(std::make_shared<rlib::soundfont::MidiModuleT<float>>(*soundFont, sampleRate));
 				}
@@ -112,8 +117,7 @@ emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
 				}
 			}
 
-			const rlib::Wav wav = smfToWav.toWav<float>(mapMidiModule);
-			wav.exportFile(oss);
+			smfToWav.exportWav<float>(mapMidiModule, oss);		// 曲の長さの制限なし (wav の形式上の上限まで)
 		}
 		const auto s = oss.str();
 		ret.set("errorCode", 0);
@@ -133,10 +137,25 @@ emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
 	return ret;
 }
 
+emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity, const std::string& fmEngine) {
+	return smfToWav(soundFont, smfBinary, fidelity, fmEngine, "chip");
+}
+
+emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary, const std::string& fidelity) {
+	return smfToWav(soundFont, smfBinary, fidelity, "note");
+}
+
+emscripten::val smfToWav(Soundfont* soundFont, const std::string& smfBinary) {
+	return smfToWav(soundFont, smfBinary, "max");
+}
+
 
 EMSCRIPTEN_BINDINGS(moduleSoundfont) {
     emscripten::function("loadSoundfont", &loadSoundfont, emscripten::return_value_policy::take_ownership());
-    emscripten::function("smfToWav", &smfToWav, emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<emscripten::val(Soundfont*, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<emscripten::val(Soundfont*, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<emscripten::val(Soundfont*, const std::string&, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
+    emscripten::function("smfToWav", emscripten::select_overload<emscripten::val(Soundfont*, const std::string&, const std::string&, const std::string&, const std::string&)>(&smfToWav), emscripten::return_value_policy::take_ownership());
 
 	emscripten::class_<Soundfont>("Soundfont")
 		.function("info", std::function{ [](const Soundfont& self) {
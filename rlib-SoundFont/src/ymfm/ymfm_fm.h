@@ -52,6 +52,170 @@ enum keyon_type : uint32_t
 
 
 
+//*********************************************************
+//  GLOBAL TABLE LOOKUPS
+//*********************************************************
+
+//-------------------------------------------------
+//  abs_sin_attenuation - given a sin (phase) input
+//  where the range 0-2*PI is mapped onto 10 bits,
+//  return the absolute value of sin(input),
+//  logarithmically-adjusted and treated as an
+//  attenuation value, in 4.8 fixed point format
+//-------------------------------------------------
+
+inline uint32_t abs_sin_attenuation(uint32_t input)
+{
+	// the values here are stored as 4.8 logarithmic values for 1/4 phase
+	// this matches the internal format of the OPN chip, extracted from the die
+	static uint16_t const s_sin_table[256] =
+	{
+		0x859,0x6c3,0x607,0x58b,0x52e,0x4e4,0x4a6,0x471,0x443,0x41a,0x3f5,0x3d3,0x3b5,0x398,0x37e,0x365,
+		0x34e,0x339,0x324,0x311,0x2ff,0x2ed,0x2dc,0x2cd,0x2bd,0x2af,0x2a0,0x293,0x286,0x279,0x26d,0x261,
+		0x256,0x24b,0x240,0x236,0x22c,0x222,0x218,0x20f,0x206,0x1fd,0x1f5,0x1ec,0x1e4,0x1dc,0x1d4,0x1cd,
+		0x1c5,0x1be,0x1b7,0x1b0,0x1a9,0x1a2,0x19b,0x195,0x18f,0x188,0x182,0x17c,0x177,0x171,0x16b,0x166,
+		0x160,0x15b,0x155,0x150,0x14b,0x146,0x141,0x13c,0x137,0x133,0x12e,0x129,0x125,0x121,0x11c,0x118,
+		0x114,0x10f,0x10b,0x107,0x103,0x0ff,0x0fb,0x0f8,0x0f4,0x0f0,0x0ec,0x0e9,0x0e5,0x0e2,0x0de,0x0db,
+		0x0d7,0x0d4,0x0d1,0x0cd,0x0ca,0x0c7,0x0c4,0x0c1,0x0be,0x0bb,0x0b8,0x0b5,0x0b2,0x0af,0x0ac,0x0a9,
+		0x0a7,0x0a4,0x0a1,0x09f,0x09c,0x099,0x097,0x094,0x092,0x08f,0x08d,0x08a,0x088,0x086,0x083,0x081,
+		0x07f,0x07d,0x07a,0x078,0x076,0x074,0x072,0x070,0x06e,0x06c,0x06a,0x068,0x066,0x064,0x062,0x060,
+		0x05e,0x05c,0x05b,0x059,0x057,0x055,0x053,0x052,0x050,0x04e,0x04d,0x04b,0x04a,0x048,0x046,0x045,
+		0x043,0x042,0x040,0x03f,0x03e,0x03c,0x03b,0x039,0x038,0x037,0x035,0x034,0x033,0x031,0x030,0x02f,
+		0x02e,0x02d,0x02b,0x02a,0x029,0x028,0x027,0x026,0x025,0x024,0x023,0x022,0x021,0x020,0x01f,0x01e,
+		0x01d,0x01c,0x01b,0x01a,0x019,0x018,0x017,0x017,0x016,0x015,0x014,0x014,0x013,0x012,0x011,0x011,
+		0x010,0x00f,0x00f,0x00e,0x00d,0x00d,0x00c,0x00c,0x00b,0x00a,0x00a,0x009,0x009,0x008,0x008,0x007,
+		0x007,0x007,0x006,0x006,0x005,0x005,0x005,0x004,0x004,0x004,0x003,0x003,0x003,0x002,0x002,0x002,
+		0x002,0x001,0x001,0x001,0x001,0x001,0x001,0x001,0x000,0x000,0x000,0x000,0x000,0x000,0x000,0x000
+	};
+
+	// if the top bit is set, we're in the second half of the curve
+	// which is a mirror image, so invert the index
+	if (bitfield(input, 8))
+		input = ~input;
+
+	// return the value from the table
+	return s_sin_table[input & 0xff];
+}
+
+
+//-------------------------------------------------
+//  attenuation_to_volume - given a 5.8 fixed point
+//  logarithmic attenuation value, return a 13-bit
+//  linear volume
+//-------------------------------------------------
+
+inline uint32_t attenuation_to_volume(uint32_t input)
+{
+	// the values here are 10-bit mantissas with an implied leading bit
+	// this matches the internal format of the OPN chip, extracted from the die
+
+	// as a nod to performance, the implicit 0x400 bit is pre-incorporated, and
+	// the values are left-shifted by 2 so that a simple right shift is all that
+	// is needed; also the order is reversed to save a NOT on the input
+#define X(a) (((a) | 0x400) << 2)
+	static uint16_t const s_power_table[256] =
+	{
+		X(0x3fa),X(0x3f5),X(0x3ef),X(0x3ea),X(0x3e4),X(0x3df),X(0x3da),X(0x3d4),
+		X(0x3cf),X(0x3c9),X(0x3c4),X(0x3bf),X(0x3b9),X(0x3b4),X(0x3ae),X(0x3a9),
+		X(0x3a4),X(0x39f),X(0x399),X(0x394),X(0x38f),X(0x38a),X(0x384),X(0x37f),
+		X(0x37a),X(0x375),X(0x370),X(0x36a),X(0x365),X(0x360),X(0x35b),X(0x356),
+		X(0x351),X(0x34c),X(0x347),X(0x342),X(0x33d),X(0x338),X(0x333),X(0x32e),
+		X(0x329),X(0x324),X(0x31f),X(0x31a),X(0x315),X(0x310),X(0x30b),X(0x306),
+		X(0x302),X(0x2fd),X(0x2f8),X(0x2f3),X(0x2ee),X(0x2e9),X(0x2e5),X(0x2e0),
+		X(0x2db),X(0x2d6),X(0x2d2),X(0x2cd),X(0x2c8),X(0x2c4),X(0x2bf),X(0x2ba),
+		X(0x2b5),X(0x2b1),X(0x2ac),X(0x2a8),X(0x2a3),X(0x29e),X(0x29a),X(0x295),
+		X(0x291),X(0x28c),X(0x288),X(0x283),X(0x27f),X(0x27a),X(0x276),X(0x271),
+		X(0x26d),X(0x268),X(0x264),X(0x25f),X(0x25b),X(0x257),X(0x252),X(0x24e),
+		X(0x249),X(0x245),X(0x241),X(0x23c),X(0x238),X(0x234),X(0x230),X(0x22b),
+		X(0x227),X(0x223),X(0x21e),X(0x21a),X(0x216),X(0x212),X(0x20e),X(0x209),
+		X(0x205),X(0x201),X(0x1fd),X(0x1f9),X(0x1f5),X(0x1f0),X(0x1ec),X(0x1e8),
+		X(0x1e4),X(0x1e0),X(0x1dc),X(0x1d8),X(0x1d4),X(0x1d0),X(0x1cc),X(0x1c8),
+		X(0x1c4),X(0x1c0),X(0x1bc),X(0x1b8),X(0x1b4),X(0x1b0),X(0x1ac),X(0x1a8),
+		X(0x1a4),X(0x1a0),X(0x19c),X(0x199),X(0x195),X(0x191),X(0x18d),X(0x189),
+		X(0x185),X(0x181),X(0x17e),X(0x17a),X(0x176),X(0x172),X(0x16f),X(0x16b),
+		X(0x167),X(0x163),X(0x160),X(0x15c),X(0x158),X(0x154),X(0x151),X(0x14d),
+		X(0x149),X(0x146),X(0x142),X(0x13e),X(0x13b),X(0x137),X(0x134),X(0x130),
+		X(0x12c),X(0x129),X(0x125),X(0x122),X(0x11e),X(0x11b),X(0x117),X(0x114),
+		X(0x110),X(0x10c),X(0x109),X(0x106),X(0x102),X(0x0ff),X(0x0fb),X(0x0f8),
+		X(0x0f4),X(0x0f1),X(0x0ed),X(0x0ea),X(0x0e7),X(0x0e3),X(0x0e0),X(0x0dc),
+		X(0x0d9),X(0x0d6),X(0x0d2),X(0x0cf),X(0x0cc),X(0x0c8),X(0x0c5),X(0x0c2),
+		X(0x0be),X(0x0bb),X(0x0b8),X(0x0b5),X(0x0b1),X(0x0ae),X(0x0ab),X(0x0a8),
+		X(0x0a4),X(0x0a1),X(0x09e),X(0x09b),X(0x098),X(0x094),X(0x091),X(0x08e),
+		X(0x08b),X(0x088),X(0x085),X(0x082),X(0x07e),X(0x07b),X(0x078),X(0x075),
+		X(0x072),X(0x06f),X(0x06c),X(0x069),X(0x066),X(0x063),X(0x060),X(0x05d),
+		X(0x05a),X(0x057),X(0x054),X(0x051),X(0x04e),X(0x04b),X(0x048),X(0x045),
+		X(0x042),X(0x03f),X(0x03c),X(0x039),X(0x036),X(0x033),X(0x030),X(0x02d),
+		X(0x02a),X(0x028),X(0x025),X(0x022),X(0x01f),X(0x01c),X(0x019),X(0x016),
+		X(0x014),X(0x011),X(0x00e),X(0x00b),X(0x008),X(0x006),X(0x003),X(0x000)
+	};
+#undef X
+
+	// look up the fractional part, then shift by the whole
+	return s_power_table[input & 0xff] >> (input >> 8);
+}
+
+
+//-------------------------------------------------
+//  attenuation_increment - given a 6-bit ADSR
+//  rate value and a 3-bit stepping index,
+//  return a 4-bit increment to the attenutaion
+//  for this step (or for the attack case, the
+//  fractional scale factor to decrease by)
+//-------------------------------------------------
+
+inline uint32_t attenuation_increment(uint32_t rate, uint32_t index)
+{
+	static uint32_t const s_increment_table[64] =
+	{
+		0x00000000, 0x00000000, 0x10101010, 0x10101010,  // 0-3    (0x00-0x03)
+		0x10101010, 0x10101010, 0x11101110, 0x11101110,  // 4-7    (0x04-0x07)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 8-11   (0x08-0x0B)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 12-15  (0x0C-0x0F)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 16-19  (0x10-0x13)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 20-23  (0x14-0x17)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 24-27  (0x18-0x1B)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 28-31  (0x1C-0x1F)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 32-35  (0x20-0x23)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 36-39  (0x24-0x27)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 40-43  (0x28-0x2B)
+		0x10101010, 0x10111010, 0x11101110, 0x11111110,  // 44-47  (0x2C-0x2F)
+		0x11111111, 0x21112111, 0x21212121, 0x22212221,  // 48-51  (0x30-0x33)
+		0x22222222, 0x42224222, 0x42424242, 0x44424442,  // 52-55  (0x34-0x37)
+		0x44444444, 0x84448444, 0x84848484, 0x88848884,  // 56-59  (0x38-0x3B)
+		0x88888888, 0x88888888, 0x88888888, 0x88888888   // 60-63  (0x3C-0x3F)
+	};
+	return bitfield(s_increment_table[rate], 4*index, 4);
+}
+
+
+//-------------------------------------------------
+//  detune_adjustment - given a 5-bit key code
+//  value and a 3-bit detune parameter, return a
+//  6-bit signed phase displacement; this table
+//  has been verified against Nuked's equations,
+//  but the equations are rather complicated, so
+//  we'll keep the simplicity of the table
+//-------------------------------------------------
+
+inline int32_t detune_adjustment(uint32_t detune, uint32_t keycode)
+{
+	static uint8_t const s_detune_adjustment[32][4] =
+	{
+		{ 0,  0,  1,  2 },  { 0,  0,  1,  2 },  { 0,  0,  1,  2 },  { 0,  0,  1,  2 },
+		{ 0,  1,  2,  2 },  { 0,  1,  2,  3 },  { 0,  1,  2,  3 },  { 0,  1,  2,  3 },
+		{ 0,  1,  2,  4 },  { 0,  1,  3,  4 },  { 0,  1,  3,  4 },  { 0,  1,  3,  5 },
+		{ 0,  2,  4,  5 },  { 0,  2,  4,  6 },  { 0,  2,  4,  6 },  { 0,  2,  5,  7 },
+		{ 0,  2,  5,  8 },  { 0,  3,  6,  8 },  { 0,  3,  6,  9 },  { 0,  3,  7, 10 },
+		{ 0,  4,  8, 11 },  { 0,  4,  8, 12 },  { 0,  4,  9, 13 },  { 0,  5, 10, 14 },
+		{ 0,  5, 11, 16 },  { 0,  6, 12, 17 },  { 0,  6, 13, 19 },  { 0,  7, 14, 20 },
+		{ 0,  8, 16, 22 },  { 0,  8, 16, 22 },  { 0,  8, 16, 22 },  { 0,  8, 16, 22 }
+	};
+	int32_t result = s_detune_adjustment[keycode][detune & 3];
+	return bitfield(detune, 2) ? -result : result;
+}
+
+
+
 //*********************************************************
 //  CORE IMPLEMENTATION
 //*********************************************************
@@ -282,9 +446,18 @@ public:
 	// master clocking function
 	void clock(uint32_t env_counter, int32_t lfo_raw_pm);
 
-	// specific 2-operator and 4-operator output handlers
+	// specific 2-operator and 4-operator output handlers; the 4-operator
+	// handler is specialized for the algorithm selected at prepare time
 	void output_2op(output_data &output, uint32_t rshift, int32_t clipmax) const;
-	void output_4op(output_data &output, uint32_t rshift, int32_t clipmax) const;
+	void output_4op(output_data &output, uint32_t rshift, int32_t clipmax) const { (this->*m_output_4op)(output, rshift, clipmax); }
+
+	// clock and compute the output for a block of samples, writing sample n
+	// to output[n * stride]; env_counter/lfo_raw_pm hold the values that
+	// clock() would have received for each sample
+	void clock_output_block(uint32_t const *env_counter, int32_t const *lfo_raw_pm, uint32_t samples, bool active, output_data *output, uint32_t stride, uint32_t rshift, int32_t clipmax)
+	{
+		(this->*m_clock_output_block)(env_counter, lfo_raw_pm, samples, active, output, stride, rshift, clipmax);
+	}
 
 	// compute the special OPL rhythm channel outputs
 	void output_rhythm_ch6(output_data &output, uint32_t rshift, int32_t clipmax) const;
@@ -306,6 +479,17 @@ public:
 	fm_operator<RegisterType> *debug_operator(uint32_t index) const { return m_op[index]; }
 
 private:
+	using output_4op_func = void (fm_channel::*)(output_data &, uint32_t, int32_t) const;
+	using clock_output_block_func = void (fm_channel::*)(uint32_t const *, int32_t const *, uint32_t, bool, output_data *, uint32_t, uint32_t, int32_t);
+
+	// output handlers specialized for each algorithm and feedback enable
+	template<uint32_t Algorithm, bool Feedback> void output_4op_alg(output_data &output, uint32_t rshift, int32_t clipmax) const;
+	template<uint32_t Algorithm, bool Feedback> void clock_output_block_alg(uint32_t const *env_counter, int32_t const *lfo_raw_pm, uint32_t samples, bool active, output_data *output, uint32_t stride, uint32_t rshift, int32_t clipmax);
+	void clock_output_block_2op(uint32_t const *env_counter, int32_t const *lfo_raw_pm, uint32_t samples, bool active, output_data *output, uint32_t stride, uint32_t rshift, int32_t clipmax);
+
+	// choose the handlers for the current algorithm and feedback registers
+	void select_output();
+
 	// helper to add values to the outputs based on channel enables
 	void add_to_output(uint32_t choffs, output_data &output, int32_t value) const
 	{
@@ -330,6 +514,8 @@ private:
 	uint32_t m_choffs;                     // channel offset in registers
 	int16_t m_feedback[2];                 // feedback memory for operator 1
 	mutable int16_t m_feedback_in;         // next input value for op 1 feedback (set in output)
+	output_4op_func m_output_4op;          // 4-operator output handler for the current algorithm
+	clock_output_block_func m_clock_output_block; // block handler for the current algorithm
 	std::array<fm_operator<RegisterType> *, 4> m_op; // up to 4 operators
 	RegisterType &m_regs;                  // direct reference to registers
 	fm_engine_base<RegisterType> &m_owner; // reference to the owning engine
@@ -351,6 +537,9 @@ public:
 	static constexpr uint32_t ALL_CHANNELS = RegisterType::ALL_CHANNELS;
 	static constexpr uint32_t OPERATORS = RegisterType::OPERATORS;
 
+	// maximum number of samples processed by one clock_block call
+	static constexpr uint32_t MAX_BLOCK_SAMPLES = 256;
+
 	// also expose status flags for consumers that inject additional bits
 	static constexpr uint8_t STATUS_TIMERA = RegisterType::STATUS_TIMERA;
 	static constexpr uint8_t STATUS_TIMERB = RegisterType::STATUS_TIMERB;
@@ -372,6 +561,9 @@ public:
 	// master clocking function
 	uint32_t clock(uint32_t chanmask);
 
+	// clock a block of samples and compute each channel's output separately
+	uint32_t clock_block(uint32_t chanmask, output_data *output, uint32_t samples, uint32_t rshift, int32_t clipmax);
+
 	// compute sum of channel outputs
 	void output(output_data &output, uint32_t rshift, int32_t clipmax, uint32_t chanmask) const;
 
@@ -432,6 +624,9 @@ public:
 	virtual void engine_mode_write(uint8_t data) override;
 
 protected:
+	// clock the state shared by all channels
+	int32_t clock_common(uint32_t chanmask);
+
 	// assign the current set of operators to channels
 	void assign_operators();
 
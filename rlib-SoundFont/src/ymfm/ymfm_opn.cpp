@@ -2485,4 +2485,13 @@ void ymf276::generate(output_data *output, uint32_t numsamples)
 	}
 }
 
+
+
+//*********************************************************
+//  EXPLICIT INSTANTIATIONS
+//*********************************************************
+
+// the OPN FM engine is also used on its own (without the SSG) by clients
+template class fm_engine_base<opn_registers>;
+
 }